@@ -193,35 +193,9 @@ public:
 	{
 		Mat hls_image, hue_image, mask_image;
 		cvtColor(mImage, hls_image, COLOR_BGR2HLS);
-
-		vector<Mat> hls_planes(3);
-		split(hls_image, hls_planes);
-		Mat saturation_minus_luminance;
-		cvtColor(mImage, saturation_minus_luminance, COLOR_BGR2GRAY);
-		Mat saturation = hls_planes[2];
-		Mat luminance = hls_planes[1];
-		for (int row = 0; row < saturation_minus_luminance.rows; row++)
-			for (int col = 0; col < saturation_minus_luminance.cols; col++)
-			{
-				int s = ((int)saturation.at<uchar>(row, col));
-				int l = ((int)luminance.at<uchar>(row, col));
-				int s_l = (((int)saturation.at<uchar>(row, col)) -(((int)luminance.at<uchar>(row, col)) / 2));
-				if (s_l < 0)
-					saturation_minus_luminance.at<uchar>(row, col) = 0;
-				else saturation_minus_luminance.at<uchar>(row, col) = s_l;
-//				saturation_minus_luminance.at<uchar>(row, col) = (((int)saturation.at<uchar>(row, col)) - ((int)luminance.at<uchar>(row, col))) > 0 ?
-//					(((int)saturation.at<uchar>(row, col)) - ((int)luminance.at<uchar>(row, col))) : 0;
-			}
-		Mat temp_image;
-		threshold(saturation_minus_luminance, mask_image, 20, 255, THRESH_BINARY); // | THRESH_OTSU);
+		// Hue plane and mask of the pixels where saturation - luminance/2 > 20, in one pass over the HLS image.
+		HueAndSaturationMask(hls_image, hue_image, mask_image, 20);
 		//inRange( hls_image, Scalar( 0, mMinimumSaturation, mMinimumValue ), Scalar( 180, 256, mMaximumValue ), mask_image );
-		cvtColor(mask_image, temp_image, COLOR_GRAY2BGR);
-		//imshow("Original image", mImage);
-		//imshow("Mask image", temp_image);
-		//char c = cv::waitKey();
-		int channels[]={0,0};
-		hue_image.create( mImage.size(), mImage.depth());
-		mixChannels( &hls_image, 1, &hue_image, 1, channels, 1 );
 		const float* channel_ranges = mChannelRange;
 		calcHist( &hue_image,1,0,mask_image,mHistogram,1,mNumberBins,&channel_ranges);
 	}
@@ -233,37 +207,12 @@ public:
 	{
 		Mat hls_image, hue_image, mask_image;
 		cvtColor(image, hls_image, COLOR_BGR2HLS);
-				vector<Mat> hls_planes(3);
-		split(hls_image, hls_planes);
-		Mat saturation_minus_luminance;
-		cvtColor(image, saturation_minus_luminance, COLOR_BGR2GRAY);
-		Mat& saturation = hls_planes[2];
-		Mat& luminance = hls_planes[1];
-		for (int row = 0; row < saturation_minus_luminance.rows; row++)
-			for (int col = 0; col < saturation_minus_luminance.cols; col++)
-			{
-				int s = ((int)saturation.at<uchar>(row, col));
-				int l = ((int)luminance.at<uchar>(row, col));
-				int s_l = (((int)saturation.at<uchar>(row, col)) - (((int)luminance.at<uchar>(row, col)) / 2));
-				if (s_l < 0)
-					saturation_minus_luminance.at<uchar>(row, col) = 0;
-				else saturation_minus_luminance.at<uchar>(row, col) = s_l;
-			}
-		Mat temp_image;
-		threshold(saturation_minus_luminance, mask_image, 20, 255, THRESH_BINARY); // | THRESH_OTSU);
-																				   //inRange( hls_image, Scalar( 0, mMinimumSaturation, mMinimumValue ), Scalar( 180, 256, mMaximumValue ), mask_image );
-		//cvtColor(mask_image, temp_image, COLOR_GRAY2BGR);
-		//imshow("Query mask", temp_image);
+		HueAndSaturationMask(hls_image, hue_image, mask_image, 20);
 		Mat result;
-		//Mat hls_image, hue_image, mask_image;
-		//cvtColor(image, hls_image, COLOR_BGR2HLS);
-		int channels[] = { 0,0 };
-		hue_image.create(image.size(), image.depth());
-		mixChannels(&hls_image, 1, &hue_image, 1, channels, 1);
 		const float* channel_ranges = mChannelRange;
 		calcBackProject(&hue_image,1,mChannelNumbers,mHistogram,result,&channel_ranges,255.0);
-		Mat masked_result_image = result & mask_image;
-		return masked_result_image.clone();
+		bitwise_and(result, mask_image, result);
+		return result;
 	}
 	MatND getHistogram()
 	{
@@ -335,18 +284,76 @@ Mat BackProjection(Mat query_image, Mat sample_image)
 	//imshow("Back Projection", output1);
 	return back_projection_probabilities_display;
 */
-	Mat& result = query_image.clone();
 	ColourHistogram histogram3D(sample_image, 8);
 	histogram3D.NormaliseHistogram();
 	Mat back_projection_probabilities = histogram3D.BackProject(query_image);
 	back_projection_probabilities = StretchImage(back_projection_probabilities);
-	Mat back_projection_probabilities_display;
-	cvtColor(back_projection_probabilities, back_projection_probabilities_display, COLOR_GRAY2BGR);
-	Mat output1 = JoinImagesHorizontally(query_image, "Original Image", back_projection_probabilities_display, "Probabilities", 4);
-	//imshow("Back Projection", output1);
 	return back_projection_probabilities;
 }
 
+// Back project the (normalised) colour histograms of several sample images onto a query image in a single sweep, finding the
+// bin of each pixel once and looking it up in all of the histograms.  The (unstretched) probability images are identical to
+// those from ColourHistogram::BackProject, and no display images are created.
+void MultiBackProjection(Mat query_image, Mat sample_images[], int number_of_samples, Mat probability_images[], int number_of_bins)
+{
+	CV_Assert(query_image.type() == CV_8UC3);
+	// Bin of each channel value over the range [0, 255) as in calcBackProject, or -1 if out of range.
+	int channel_bins[256];
+	for (int value = 0; value < 256; value++)
+	{
+		int bin = cvFloor(value * (number_of_bins / 255.0));
+		channel_bins[value] = (bin < number_of_bins) ? bin : -1;
+	}
+	// Scaled histogram values, with the values of all samples for a bin stored together.
+	int number_of_cells = number_of_bins * number_of_bins * number_of_bins;
+	vector<uchar> cell_values(number_of_cells * number_of_samples);
+	for (int sample = 0; sample < number_of_samples; sample++)
+	{
+		ColourHistogram histogram3D(sample_images[sample], number_of_bins);
+		histogram3D.NormaliseHistogram();
+		MatND histogram = histogram3D.getHistogram();
+		const float* histogram_values = histogram.ptr<float>();
+		for (int cell = 0; cell < number_of_cells; cell++)
+		{
+			cell_values[cell * number_of_samples + sample] = saturate_cast<uchar>(histogram_values[cell] * (float)255.0);
+		}
+	}
+	for (int sample = 0; sample < number_of_samples; sample++)
+	{
+		probability_images[sample].create(query_image.size(), CV_8UC1);
+	}
+	// Rows are back projected in parallel.
+	parallel_for_(Range(0, query_image.rows), [&](const Range& rows)
+	{
+		vector<uchar*> probability_rows(number_of_samples);
+		for (int row = rows.start; row < rows.end; row++)
+		{
+			const uchar* pixels = query_image.ptr<uchar>(row);
+			for (int sample = 0; sample < number_of_samples; sample++)
+			{
+				probability_rows[sample] = probability_images[sample].ptr<uchar>(row);
+			}
+			for (int column = 0; column < query_image.cols; column++, pixels += 3)
+			{
+				int blue_bin = channel_bins[pixels[0]];
+				int green_bin = channel_bins[pixels[1]];
+				int red_bin = channel_bins[pixels[2]];
+				if ((blue_bin < 0) || (green_bin < 0) || (red_bin < 0))
+				{
+					for (int sample = 0; sample < number_of_samples; sample++)
+						probability_rows[sample][column] = 0;
+				}
+				else
+				{
+					const uchar* values = &cell_values[((blue_bin * number_of_bins + green_bin) * number_of_bins + red_bin) * number_of_samples];
+					for (int sample = 0; sample < number_of_samples; sample++)
+						probability_rows[sample][column] = values[sample];
+				}
+			}
+		}
+	});
+}
+
 void HistogramsDemos( Mat& dark_image, Mat& fruit_image, Mat& people_image, Mat& skin_image, Mat all_images[], int number_of_images )
 {
 	// Just so that tests can be done using a grayscale image...
@@ -4,9 +4,18 @@
 #include <list>
 #include <experimental/filesystem> // C++-standard header file name
 #include <filesystem> // Microsoft-specific implementation header file name
-#include <regex>
 #include <string>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <new>
+#include <cstdlib>
 using namespace std::experimental::filesystem::v1;
 using namespace std;
 
@@ -30,6 +39,62 @@ using namespace std;
 #define SQUARE_DIMENSIONS_IN_PIXELS (BOARD_DIMENSIONS_IN_PIXELS/NUMBER_OF_SQUARES_ON_EACH_SIDE)
 #define PIXELS_IN_SQUARE (SQUARE_DIMENSIONS_IN_PIXELS*SQUARE_DIMENSIONS_IN_PIXELS)
 #define NUMBER_OF_STATIC_IMAGES 69
+#define PIPELINE_FRAMES 8
+// A pipeline stage retries a full or empty queue this many times before blocking (see SingleProducerSingleConsumerQueue).
+#define QUEUE_SPIN_ATTEMPTS 64
+#define END_OF_VIDEO -1
+#define SEGMENT_WARM_UP_FRAMES 30
+// A segment's starting board must be detected unchanged in this many unobscured warm-up frames (see MoveTracker::seedBoard).
+#define SEED_CONFIRMATION_FRAMES 5
+#define MOVE_WINDOW_FRAMES 10
+// A square change must be seen in this many of MOVE_WINDOW_FRAMES frames (or in this many settled frames if only settled frames are
+// classified, see MotionGate).
+#define CHANGE_PERSISTENCE_FRAMES 5
+#define GATED_CHANGE_PERSISTENCE_FRAMES 2
+#define NO_FRAME -1
+#define COLOUR_BINS 8
+// Each channel value falls into one of the histogram bins, or into an extra cell for values beyond the histogram range (i.e. 255).
+#define COLOUR_CELLS_PER_CHANNEL (COLOUR_BINS+1)
+#define NUMBER_OF_COLOUR_CELLS (COLOUR_CELLS_PER_CHANNEL*COLOUR_CELLS_PER_CHANNEL*COLOUR_CELLS_PER_CHANNEL)
+#define NUMBER_OF_COLOUR_SAMPLES 4
+#define WHITE_PIECE_PIXEL 0
+#define BLACK_PIECE_PIXEL 1
+#define WHITE_SQUARE_PIXEL 2
+#define BLACK_SQUARE_PIXEL 3
+#define BACKGROUND_PIXEL 4
+#define NUMBER_OF_PIXEL_CLASSES (BACKGROUND_PIXEL+1)
+#define UNLABELLED_PIXEL 255
+// Pixels are background unless their highest stretched back projection is over this (see ColourClassifier::classify).
+#define BACKGROUND_PROBABILITY_THRESHOLD 127
+#define WARPED_BOARD_CACHE_DIRECTORY "WarpedBoardCache"
+// Part of the key of every cached warped board.  Increase it whenever a change to the decoding or warping changes the warped pixels.
+#define WARPED_BOARD_CACHE_VERSION 1
+// The warped board cache is not used (or created) if this environment variable is set.
+#define DISABLE_WARPED_BOARD_CACHE_VARIABLE "DRAUGHTS_NO_WARPED_BOARD_CACHE"
+// JPEG stills can be decoded at 1/1, 1/2, 1/4 or 1/8 scale.
+#define NUMBER_OF_DECODE_SCALES 4
+// Size of the images and video frames in which the board corners are given (see BOARD_CORNERS).
+#define REFERENCE_FRAME_WIDTH 480
+#define REFERENCE_FRAME_HEIGHT 270
+// Default parameters for classifying the squares (see StillImageParameters).
+#define DIFFERENCE_THRESHOLD 30
+#define OCCUPANCY_THRESHOLD 0.25f
+#define KING_CIRCULARITY_THRESHOLD 0.80
+#define PIECE_COLOUR_HUE_BINS 25
+// Motion gate states and parameters (see MotionGate).
+#define GATE_IDLE 0
+#define GATE_MOTION 1
+#define GATE_SETTLING 2
+#define GATE_SETTLED 3
+#define MOTION_DOWNSAMPLING 8
+#define MOTION_ENERGY_THRESHOLD 2.0
+#define SETTLING_FRAMES 5
+// The board counts as settled again after this many idle frames (less than MOVE_WINDOW_FRAMES, so that a change seen on one settled
+// frame can be confirmed on the next).
+#define MAXIMUM_IDLE_FRAMES 8
+// Frame deduplication parameters (see FrameDeduplicator).
+#define FRAME_SIGNATURE_SIZE 16
+#define FRAME_SIGNATURE_TOLERANCE 2.0
 
 // struct definitions.
 // Struct to store info on differences in squares tracked across frames.
@@ -37,13 +102,13 @@ struct DifferenceLog
 {
 	// The frame number in which the first relevant difference was detected.
 	int first_frame_number;
-	// The frequency of the difference.
-	int frequency;
+	// The frames (as bits offset from first_frame_number) in which the difference was detected.  0 if no difference is being tracked.
+	unsigned short frames;
 
-	DifferenceLog(int frame_number)
+	DifferenceLog()
 	{
-		this->first_frame_number = frame_number;
-		this->frequency = 1;
+		this->first_frame_number = 0;
+		this->frames = 0;
 	}
 };
 
@@ -59,6 +124,14 @@ struct SquareChange
 	// The square state after the change.
 	int after;
 
+	SquareChange()
+	{
+		this->square_number = 0;
+		this->frame_number = NO_FRAME;
+		this->before = EMPTY_SQUARE;
+		this->after = EMPTY_SQUARE;
+	}
+
 	SquareChange(int square_number, int frame_number, int before, int after)
 	{
 		this->square_number = square_number;
@@ -89,18 +162,79 @@ struct Move
 	}
 };
 
+// Struct to store the results of processing a video frame as it passes through the stages of the move tracker.
+struct FrameAnalysis
+{
+	// The frame number (or END_OF_VIDEO).
+	int frame_number;
+	// The video frame.
+	Mat frame;
+	// The perspective transformed board (or its dark squares).
+	Mat board_pt;
+	// The binary image of points which differ from the empty board.
+	Mat moving_points;
+	// The number of object pixels in moving_points.
+	int object_pixels;
+	// The fraction of each square which is object pixels in moving_points.
+	float occupancy[NUMBER_OF_SQUARES];
+	// The confidence in the colour of the piece in each square (see getPieceColours).
+	float colour_margin[NUMBER_OF_SQUARES];
+	// The detected state of the board.
+	int board[NUMBER_OF_SQUARES];
+	// The number of pieces detected on the board.
+	int detected_piece_count;
+	// Whether the squares are classified in this frame (always, unless the motion gate is used).
+	bool settled;
+	// Whether the frame is a duplicate of the last frame processed, whose analysis is reused (see FrameDeduplicator).
+	bool duplicate;
+};
+
+// Struct to store the moves recorded in one segment of a video (see trackMovesInSegments).
+struct VideoSegment
+{
+	// The first frame owned by the segment.
+	int first_frame;
+	// The first frame owned by the next segment (or END_OF_VIDEO for the last segment).
+	int end_frame;
+	// The moves recorded by the segment (including those in the warm-up before first_frame).
+	vector<Move> moves;
+	// Whether the segment established its board state by first_frame (during its warm-up, or from a given board).
+	bool board_at_start_known;
+	// The tracked board state at first_frame and at end_frame.
+	int board_at_start[NUMBER_OF_SQUARES];
+	int board_at_end[NUMBER_OF_SQUARES];
+	// The number of frames processed in the segment (excluding the warm-up).
+	int number_of_frames;
+};
+
 // Function definitions.
+struct StillImage;
 void part1(Mat black_pieces_image, Mat white_pieces_image, Mat black_squares_image, Mat white_squares_image);
-void part2(Mat empty_board_image, int confusion_matrix[3][3], Mat white_pieces_image, Mat black_pieces_image);
-void part3(Mat empty_board_image, VideoCapture video);
+void part2(StillImage& still, int confusion_matrix[3][3]);
+int part3(Mat empty_board_image, VideoCapture video, TrackingOptions options = TrackingOptions());
 void part4(Mat empty_board_image);
-void part5(Mat empty_board_image, int extended_confusion_matrix[5][5]);
+void part5(StillImage& still, int extended_confusion_matrix[5][5]);
+
+class BinaryMask;
+struct FrameWorkspace;
+class BoardStateDetector;
+class MoveTracker;
+struct PixelClassMetrics;
+int trackMoves(VideoCapture& video, BoardStateDetector& detector, MoveTracker& tracker, TrackingOptions options);
+int trackMovesInPipeline(VideoCapture& video, BoardStateDetector& detector, MoveTracker& tracker, TrackingOptions options);
+int trackMovesInSegments(string video_filename, Mat empty_board_image, TrackingOptions options);
+void trackMovesInSegment(string video_filename, BoardStateDetector& detector, VideoSegment& segment, TrackingOptions options, const int* start_board = NULL);
+void compareMovesWithGroundTruth(vector<Move> moves);
+bool isMoveDetected(const Move& actual_move, const Move& detected_move);
+int SweepChangePersistence(string video_filename, Mat empty_board_image, vector<double> change_persistence_frames);
 
 void printMatrix(string name, Mat matrix, int limit);
 void displayImage(string name, Mat image);
-int getObjectPixelsInImage(Mat binary_image);
+int getSquareOccupancy(Mat binary_image, float occupancy[NUMBER_OF_SQUARES]);
+int getSquareOccupancy(BinaryMask& mask, float occupancy[NUMBER_OF_SQUARES]);
 
 Mat perspectiveTransformation(Mat board_image);
+void perspectiveTransformation(Mat board_image, Mat& result);
 Mat getStructuringElement3x3();
 Mat getStructuringElement5x5();
 
@@ -108,25 +242,34 @@ Mat erode(Mat binary_image, Mat structuring_element);
 Mat dilate(Mat binary_image, Mat structuring_element);
 Mat opening(Mat binary_image, Mat structuring_element);
 Mat closing(Mat binary_image, Mat structuring_element);
+void erode(Mat binary_image, Mat& eroded_image, Mat structuring_element);
+void dilate(Mat binary_image, Mat& dilated_image, Mat structuring_element);
+void opening(Mat binary_image, Mat& opened_image, Mat structuring_element);
+void closing(Mat binary_image, Mat& closed_image, Mat structuring_element);
 
 int getSquare(int x, int y);
 void getSquareCoordinates(int square_number, int coordinates[2]);
+Mat getSquareImage(Mat image, int square_number);
 bool isBlackSquare(int top_left_x, int top_left_y);
-int getNumberOfObjectPixelsInSquare(Mat binary_image, int top_left_x, int top_left_y);
-bool isPieceInSquare(Mat binary_image, int top_left_x, int top_left_y);
-bool isPieceInSquare(Mat binary_image, int square_number);
+bool isPieceInSquare(float square_occupancy, float occupancy_threshold = OCCUPANCY_THRESHOLD);
 bool isBlackPiece(Mat rgb_image, int top_left_x, int top_left_y);
-bool isBlackPiece(Mat rgb_image, int square_number);
+void getPieceColours(Mat rgb_image, Mat binary_image, Mat& hsv_image, bool is_black_piece[NUMBER_OF_SQUARES], float colour_margin[NUMBER_OF_SQUARES], int number_of_hue_bins = PIECE_COLOUR_HUE_BINS);
 bool isValidMove(int previous_board[NUMBER_OF_SQUARES], int current_board[NUMBER_OF_SQUARES], int from, int to);
 void executeMove(int previous_board[NUMBER_OF_SQUARES], int current_board[NUMBER_OF_SQUARES], int from, int to);
-bool isKing(Mat binary_image, int top_left_x, int top_left_y);
-int checkBoardGroundTruth(int square_number, string white_pieces, string black_pieces);
-int checkBoardGroundTruthWithKings(int square_number, string white_pieces, string black_pieces);
+bool isKing(Mat binary_image, int top_left_x, int top_left_y, double circularity_threshold = KING_CIRCULARITY_THRESHOLD);
 void updateConfusionMatrix(int confusion_matrix[3][3], int detected_square_contents, int actual_square_contents);
 void updateExtendedConfusionMatrix(int extended_confusion_matrix[5][5], int detected_square_contents, int actual_square_contents);
+void colourToLabels(Mat colour_image, Mat& label_image);
+void evaluatePixelLabels(Mat detected_labels, Mat ground_truth_labels, PixelClassMetrics& metrics);
+void evaluatePixelLabels(vector<Mat>& detected_labels, vector<Mat>& ground_truth_labels, PixelClassMetrics& metrics);
+void printPixelClassMetrics(PixelClassMetrics& metrics);
+bool loadColourSamples(Mat samples[NUMBER_OF_COLOUR_SAMPLES]);
+int SweepPixelProbabilityThresholds(vector<double> probability_thresholds);
 
 Mat extractHue(Mat rgb_image);
 Mat hueHistogram(Mat image, int bins);
+void extractHue(Mat rgb_image, Mat& hsv_image, Mat& hue);
+void hueHistogram(Mat rgb_image, int bins, Mat& hsv_image, Mat& hue, Mat& hist);
 void displayHistogram(string name, Mat hist, int bins);
 Mat backproject(int, void*, Mat image, Mat* hue);
 void histogramAndBackproject(string name, Mat sample_image, Mat rgb_image, int bins);
@@ -137,7 +280,7 @@ void findCorners(Mat board_image);
 
 // Data provided:  Filename, White pieces, Black pieces
 // Note that this information can ONLY be used to evaluate performance.  It must not be used during processing of the images.
-const string GROUND_TRUTH_FOR_BOARD_IMAGES[][3] = {
+constexpr const char* GROUND_TRUTH_FOR_BOARD_IMAGES[][3] = {
 	{"DraughtsGame1Move0.JPG", "1,2,3,4,5,6,7,8,9,10,11,12", "21,22,23,24,25,26,27,28,29,30,31,32"},
 	{"DraughtsGame1Move1.JPG", "1,2,3,4,5,6,7,8,10,11,12,13", "21,22,23,24,25,26,27,28,29,30,31,32"},
 	{"DraughtsGame1Move2.JPG", "1,2,3,4,5,6,7,8,10,11,12,13", "20,21,22,23,25,26,27,28,29,30,31,32"},
@@ -209,6 +352,65 @@ const string GROUND_TRUTH_FOR_BOARD_IMAGES[][3] = {
 	{"DraughtsGame1Move68.JPG", "", "K2,K4,15,19,20"}
 };
 
+// Ground truth contents (EMPTY_SQUARE, WHITE_MAN_ON_SQUARE, ...) of each square of a board.
+typedef array<uint8_t, NUMBER_OF_SQUARES> GroundTruthBoard;
+
+// Place the pieces listed in a ground truth string (e.g. "1,K2,3") onto a board, as DraughtsBoard::loadGroundTruth does.
+constexpr void parseGroundTruthPieces(const char* pieces, int man_type, int king_type, GroundTruthBoard& board)
+{
+	int index = 0;
+	while (pieces[index] != '\0')
+	{
+		bool is_king = false;
+		if (pieces[index] == 'K')
+		{
+			is_king = true;
+			index++;
+		}
+		int location = 0;
+		while ((pieces[index] >= '0') && (pieces[index] <= '9'))
+		{
+			location = location * 10 + (pieces[index] - '0');
+			index++;
+		}
+		if (pieces[index] != '\0')
+			index++;
+		if ((location > 0) && (location <= NUMBER_OF_SQUARES))
+			board[location - 1] = (uint8_t)((is_king) ? king_type : man_type);
+	}
+}
+
+// Parse the ground truth for one board.  Kings are recorded as men unless with_kings is set.  The white pieces are placed last
+// so that they take priority (as in the original search of the white and then the black pieces for each square).
+constexpr GroundTruthBoard parseGroundTruthBoard(const char* white_pieces, const char* black_pieces, bool with_kings)
+{
+	GroundTruthBoard board = {};
+	parseGroundTruthPieces(black_pieces, BLACK_MAN_ON_SQUARE, with_kings ? BLACK_KING_ON_SQUARE : BLACK_MAN_ON_SQUARE, board);
+	parseGroundTruthPieces(white_pieces, WHITE_MAN_ON_SQUARE, with_kings ? WHITE_KING_ON_SQUARE : WHITE_MAN_ON_SQUARE, board);
+	return board;
+}
+
+template <size_t... IMAGE_INDICES>
+constexpr array<GroundTruthBoard, NUMBER_OF_STATIC_IMAGES> parseGroundTruthBoards(index_sequence<IMAGE_INDICES...>, bool with_kings)
+{
+	return { { parseGroundTruthBoard(GROUND_TRUTH_FOR_BOARD_IMAGES[IMAGE_INDICES][1], GROUND_TRUTH_FOR_BOARD_IMAGES[IMAGE_INDICES][2], with_kings)... } };
+}
+
+// The ground truth for the static images, parsed at compile time (without and with kings).
+constexpr array<GroundTruthBoard, NUMBER_OF_STATIC_IMAGES> GROUND_TRUTH_BOARDS = parseGroundTruthBoards(make_index_sequence<NUMBER_OF_STATIC_IMAGES>(), false);
+constexpr array<GroundTruthBoard, NUMBER_OF_STATIC_IMAGES> GROUND_TRUTH_BOARDS_WITH_KINGS = parseGroundTruthBoards(make_index_sequence<NUMBER_OF_STATIC_IMAGES>(), true);
+static_assert(sizeof(GROUND_TRUTH_FOR_BOARD_IMAGES) / sizeof(GROUND_TRUTH_FOR_BOARD_IMAGES[0]) == NUMBER_OF_STATIC_IMAGES, "One ground truth entry is needed for each static image");
+static_assert((GROUND_TRUTH_BOARDS[20][1] == BLACK_MAN_ON_SQUARE) && (GROUND_TRUTH_BOARDS_WITH_KINGS[20][1] == BLACK_KING_ON_SQUARE) &&
+	(GROUND_TRUTH_BOARDS_WITH_KINGS[49][29] == WHITE_KING_ON_SQUARE) && (GROUND_TRUTH_BOARDS[68][0] == EMPTY_SQUARE), "Ground truth parsed incorrectly");
+
+// Corners of the board in the images and video frames (top-left, bottom-left, top-right, bottom-right), which are all the size of
+// the reference frame.
+const Point2f BOARD_CORNERS[4] = { Point2f(114.0, 17.0), Point2f(53.0, 245.0), Point2f(355.0, 20.0), Point2f(433.0, 241.0) };
+const int DECODE_SCALES[NUMBER_OF_DECODE_SCALES] = { 1, 2, 4, 8 };
+// (The reduced decodes would otherwise apply the EXIF orientation, which IMREAD_UNCHANGED does not, and so not match the board corners.)
+const int DECODE_SCALE_FLAGS[NUMBER_OF_DECODE_SCALES] = { IMREAD_UNCHANGED, IMREAD_REDUCED_COLOR_2 | IMREAD_IGNORE_ORIENTATION,
+	IMREAD_REDUCED_COLOR_4 | IMREAD_IGNORE_ORIENTATION, IMREAD_REDUCED_COLOR_8 | IMREAD_IGNORE_ORIENTATION };
+
 // Data provided: Approx frame no, From square number, To square number
 // Note that the first move is a White move (and then the moves alternate Black, White, Black, White...)
 // This data corresponds to the video:  DraughtsGame1.avi
@@ -298,591 +500,2706 @@ void DraughtsBoard::loadGroundTruth(string pieces, int man_type, int king_type)
 	}
 }
 
-void MyApplication()
+// Class to perform the perspective transformation of the board.
+// The homography (and optional lens undistortion) is computed once and stored as fixed-point remap tables,
+// so that each image only costs a single remap into the (reusable) result buffer.
+class BoardWarp
 {
-	string video_filename("Media/DraughtsGame1.avi");
-	VideoCapture video;
-	video.open(video_filename);
+private:
+	Mat mPerspectiveMatrix;
+	Mat mCameraMatrix;
+	Mat mDistortionCoefficients;
+	Mat mMapXY;
+	Mat mMapInterpolation;
+	Mat mSquaresMapXY;
+	Mat mSquaresMapInterpolation;
+	void computeRemapTables();
+	void distortPoint(double& x, double& y);
+public:
+	BoardWarp(const Point2f source[4] = BOARD_CORNERS, Mat camera_matrix = Mat(), Mat distortion_coefficients = Mat());
+	void warp(Mat board_image, Mat& result);
+	void warpSquares(Mat board_image, Mat& result);
+	Mat getPerspectiveMatrix();
+	uint64 getParametersHash();
+};
 
-	string black_pieces_filename("Media/DraughtsGame1BlackPieces.jpg");
-	Mat black_pieces_image = imread(black_pieces_filename, -1);
-	string white_pieces_filename("Media/DraughtsGame1WhitePieces.jpg");
-	Mat white_pieces_image = imread(white_pieces_filename, -1);
-	string black_squares_filename("Media/DraughtsGame1BlackSquares.jpg");
-	Mat black_squares_image = imread(black_squares_filename, -1);
-	string white_squares_filename("Media/DraughtsGame1WhiteSquares.jpg");
-	Mat white_squares_image = imread(white_squares_filename, -1);
-	string background_filename("Media/DraughtsGame1EmptyBoard.JPG");
-	Mat static_background_image = imread(background_filename, -1);
-	if ((!video.isOpened()) || (black_pieces_image.empty()) || (white_pieces_image.empty()) || (black_squares_image.empty()) || (white_squares_image.empty())  || (static_background_image.empty()))
+BoardWarp::BoardWarp(const Point2f source[4], Mat camera_matrix, Mat distortion_coefficients)
+{
+	Point2f destination[4] = { Point2f(0, 0), Point2f(0, BOARD_DIMENSIONS_IN_PIXELS), Point2f(BOARD_DIMENSIONS_IN_PIXELS, 0), Point2f(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS) };
+	mPerspectiveMatrix = getPerspectiveTransform(source, destination);
+	// Camera matrix and distortion coefficients are as computed by CameraCalibration().
+	if (!camera_matrix.empty() && !distortion_coefficients.empty())
 	{
-		// Error attempting to load something.
-		if (!video.isOpened())
-			cout << "Cannot open video file: " << video_filename << endl;
-		if (black_pieces_image.empty())
-			cout << "Cannot open image file: " << black_pieces_filename << endl;
-		if (white_pieces_image.empty())
-			cout << "Cannot open image file: " << white_pieces_filename << endl;
-		if (black_squares_image.empty())
-			cout << "Cannot open image file: " << black_squares_filename << endl;
-		if (white_squares_image.empty())
-			cout << "Cannot open image file: " << white_squares_filename << endl;
-		if (static_background_image.empty())
-			cout << "Cannot open image file: " << background_filename << endl;
+		camera_matrix.convertTo(mCameraMatrix, CV_64F);
+		distortion_coefficients.reshape(1, 1).convertTo(mDistortionCoefficients, CV_64F);
 	}
-	else
-	{	
-		/* RECOMMENDED TO COMMENT OUT PARTS AND RUN EACH INDIVIDUALLY*/
-		// Classify the pixels.
-		part1(black_pieces_image, white_pieces_image, black_squares_image, white_squares_image);
-
-		// Compute confusion matrix for pieces in squares.
-		int confusion_matrix[3][3] = {{0, 0, 0},
-									   {0, 0, 0}, 
-									   {0, 0, 0} };
-		part2(static_background_image, confusion_matrix, white_pieces_image, black_pieces_image);
-		cout << "Confusion Matrix:\n"
-			<< "\tGT_NP\tGT_WP\tGT_BP\n"
-			<< "D_NP\t" << confusion_matrix[0][0] << "\t" << confusion_matrix[0][1] << "\t" << confusion_matrix[0][2] << "\n" 
-			<< "D_WP\t" << confusion_matrix[1][0] << "\t" << confusion_matrix[1][1] << "\t" << confusion_matrix[1][2] << "\n" 
-			<< "D_BP\t" << confusion_matrix[2][0] << "\t" << confusion_matrix[2][1] << "\t" << confusion_matrix[2][2] << endl;
-
-		// Record moves in video.
-		part3(static_background_image, video);
+	computeRemapTables();
+}
 
-		// Identify four corners of the chessboard.
-		part4(static_background_image);
+// Compute the board-to-image remap tables in the same fixed-point format that warpPerspective uses internally.
+void BoardWarp::computeRemapTables()
+{
+	Mat inverse_matrix = mPerspectiveMatrix.inv();
+	const double* M = inverse_matrix.ptr<double>(0);
+	bool undistort = !mCameraMatrix.empty();
+	mMapXY.create(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS, CV_16SC2);
+	mMapInterpolation.create(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS, CV_16UC1);
+	for (int y = 0; y < BOARD_DIMENSIONS_IN_PIXELS; y++)
+	{
+		short* xy = mMapXY.ptr<short>(y);
+		ushort* interpolation = mMapInterpolation.ptr<ushort>(y);
+		for (int x = 0; x < BOARD_DIMENSIONS_IN_PIXELS; x++)
+		{
+			double W = M[6] * x + M[7] * y + M[8];
+			W = W ? INTER_TAB_SIZE / W : 0;
+			double image_x = (M[0] * x + M[1] * y + M[2]) * W;
+			double image_y = (M[3] * x + M[4] * y + M[5]) * W;
+			if (undistort)
+			{
+				image_x /= INTER_TAB_SIZE;
+				image_y /= INTER_TAB_SIZE;
+				distortPoint(image_x, image_y);
+				image_x *= INTER_TAB_SIZE;
+				image_y *= INTER_TAB_SIZE;
+			}
+			int X = saturate_cast<int>(image_x);
+			int Y = saturate_cast<int>(image_y);
+			xy[x * 2] = saturate_cast<short>(X >> INTER_BITS);
+			xy[x * 2 + 1] = saturate_cast<short>(Y >> INTER_BITS);
+			interpolation[x] = (ushort)((Y & (INTER_TAB_SIZE - 1)) * INTER_TAB_SIZE + (X & (INTER_TAB_SIZE - 1)));
+		}
+	}
 
-		// Distinguish between normal pieces and kings.
-		int extended_confusion_matrix[5][5] = {{0, 0, 0, 0, 0},
-									            {0, 0, 0, 0, 0},
-									            {0, 0, 0, 0, 0} };
-		part5(static_background_image, extended_confusion_matrix);
-		cout << "Confusion Matrix:\n"
-			<< "\tGT_NP\tGT_WM\tGT_WK\tGT_BM\tGT_BK\n"
-			<< "D_NP\t" << extended_confusion_matrix[0][0] << "\t" << extended_confusion_matrix[0][1] << "\t" << extended_confusion_matrix[0][2] << "\t" << extended_confusion_matrix[0][3] << "\t" << extended_confusion_matrix[0][4] << "\n"
-			<< "D_WM\t" << extended_confusion_matrix[1][0] << "\t" << extended_confusion_matrix[1][1] << "\t" << extended_confusion_matrix[1][2] << "\t" << extended_confusion_matrix[1][3] << "\t" << extended_confusion_matrix[1][4] << "\n"
-			<< "D_WK\t" << extended_confusion_matrix[1][0] << "\t" << extended_confusion_matrix[2][1] << "\t" << extended_confusion_matrix[2][2] << "\t" << extended_confusion_matrix[2][3] << "\t" << extended_confusion_matrix[2][4] << "\n"
-			<< "D_BM\t" << extended_confusion_matrix[1][0] << "\t" << extended_confusion_matrix[3][1] << "\t" << extended_confusion_matrix[3][2] << "\t" << extended_confusion_matrix[3][3] << "\t" << extended_confusion_matrix[3][4] << "\n"
-			<< "D_BK\t" << extended_confusion_matrix[2][0] << "\t" << extended_confusion_matrix[4][1] << "\t" << extended_confusion_matrix[4][2] << "\t" << extended_confusion_matrix[4][3] << "\t" << extended_confusion_matrix[4][4] << endl;
+	// Gather the entries for the dark (playable) squares only, in square-major order.
+	mSquaresMapXY.create(NUMBER_OF_SQUARES * SQUARE_DIMENSIONS_IN_PIXELS, SQUARE_DIMENSIONS_IN_PIXELS, CV_16SC2);
+	mSquaresMapInterpolation.create(NUMBER_OF_SQUARES * SQUARE_DIMENSIONS_IN_PIXELS, SQUARE_DIMENSIONS_IN_PIXELS, CV_16UC1);
+	for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+	{
+		int coordinates[2] = { -1, -1 };
+		getSquareCoordinates(square_number, coordinates);
+		Rect square(coordinates[0], coordinates[1], SQUARE_DIMENSIONS_IN_PIXELS, SQUARE_DIMENSIONS_IN_PIXELS);
+		Mat square_map_xy = getSquareImage(mSquaresMapXY, square_number);
+		Mat square_map_interpolation = getSquareImage(mSquaresMapInterpolation, square_number);
+		mMapXY(square).copyTo(square_map_xy);
+		mMapInterpolation(square).copyTo(square_map_interpolation);
 	}
 }
 
-void part1(Mat black_pieces_image, Mat white_pieces_image, Mat black_squares_image, Mat white_squares_image)
+// Map a point in the undistorted image to its location in the original (distorted) image.
+void BoardWarp::distortPoint(double& x, double& y)
 {
-	// Load image to classify.
-	string source_filename = "Media/DraughtsGame1Move0.JPG";
-	Mat source_image = imread(source_filename, -1);
-	if (source_image.empty())
+	double fx = mCameraMatrix.at<double>(0, 0);
+	double fy = mCameraMatrix.at<double>(1, 1);
+	double cx = mCameraMatrix.at<double>(0, 2);
+	double cy = mCameraMatrix.at<double>(1, 2);
+	double k[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+	for (int i = 0; i < 5 && i < (int)mDistortionCoefficients.total(); i++)
 	{
-		cout << "Cannot open image file: " << source_filename << endl;
+		k[i] = mDistortionCoefficients.at<double>(i);
 	}
+	double normalised_x = (x - cx) / fx;
+	double normalised_y = (y - cy) / fy;
+	double r2 = normalised_x * normalised_x + normalised_y * normalised_y;
+	double radial = 1 + k[0] * r2 + k[1] * r2 * r2 + k[4] * r2 * r2 * r2;
+	double distorted_x = normalised_x * radial + 2 * k[2] * normalised_x * normalised_y + k[3] * (r2 + 2 * normalised_x * normalised_x);
+	double distorted_y = normalised_y * radial + k[2] * (r2 + 2 * normalised_y * normalised_y) + 2 * k[3] * normalised_x * normalised_y;
+	x = fx * distorted_x + cx;
+	y = fy * distorted_y + cy;
+}
 
-	// Show source image.
-	displayImage("Source", source_image);
+// Warp the board image into the result (which is only allocated if it is not already the right size and type).
+void BoardWarp::warp(Mat board_image, Mat& result)
+{
+	remap(board_image, result, mMapXY, mMapInterpolation, INTER_LINEAR, BORDER_CONSTANT, Scalar());
+}
 
-	/*// Use k-means clustering.
-	Mat data;
-	source_image.convertTo(data, CV_32F);
-	data = data.reshape(1, data.total());
-	Mat labels, centers;
-	kmeans(data, 4, labels, TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 100, 0.5), 3, KMEANS_PP_CENTERS, centers);
-	centers = centers.reshape(3, centers.rows);
-	data = data.reshape(3, data.rows);
-	Vec3f* p = data.ptr<Vec3f>();
-	for (int i = 0; i < data.rows; i++) 
+// Warp only the dark squares into a compact square-major image (NUMBER_OF_SQUARES squares stacked vertically),
+// in which each square is contiguous in memory.  Pixels are identical to those produced by warp().
+void BoardWarp::warpSquares(Mat board_image, Mat& result)
+{
+	remap(board_image, result, mSquaresMapXY, mSquaresMapInterpolation, INTER_LINEAR, BORDER_CONSTANT, Scalar());
+}
+
+Mat BoardWarp::getPerspectiveMatrix()
+{
+	return mPerspectiveMatrix;
+}
+
+// Hash of everything which determines the warped image (other than the image itself), for keying cached results.
+uint64 BoardWarp::getParametersHash()
+{
+	int board_dimensions = BOARD_DIMENSIONS_IN_PIXELS;
+	uint64 hash = HashBytes(&board_dimensions, sizeof(board_dimensions));
+	Mat parameters[3] = { mPerspectiveMatrix, mCameraMatrix, mDistortionCoefficients };
+	for (Mat& parameter : parameters)
 	{
-		int center_id = labels.at<int>(i);
-		p[i] = centers.at<Vec3f>(center_id);
+		Mat continuous_parameter = parameter.isContinuous() ? parameter : parameter.clone();
+		hash = HashBytes(continuous_parameter.data, continuous_parameter.total() * continuous_parameter.elemSize(), hash);
 	}
-	source_image = data.reshape(3, source_image.rows);
-	source_image.convertTo(source_image, CV_8U);
-	displayImage("k-means", source_image);*/
+	return hash;
+}
 
-	/*// Backprojections using hue histograms.
-	int bins = 25;
-	histogramAndBackproject("white pieces", white_pieces_image, source_image, bins);
-	histogramAndBackproject("black pieces", black_pieces_image, source_image, bins);
-	histogramAndBackproject("white squares", white_squares_image, source_image, bins);
-	histogramAndBackproject("black squares", black_squares_image, source_image, bins);*/
+// Class for a binary image packed 64 pixels to a word, with morphology (using square structuring elements) implemented with
+// shifts and bitwise operations on whole words.  As in OpenCV, pixels beyond the image are treated as set when eroding and unset when dilating.
+class BinaryMask
+{
+private:
+	int mRows;
+	int mColumns;
+	int mWordsPerRow;
+	// Mask of the valid bits in the last word of each row.
+	uint64 mLastWordMask;
+	vector<uint64> mWords;
+	vector<uint64> mTemporaryWords;
+	void horizontalPass(int radius, bool dilation);
+	void verticalPass(int radius, bool dilation);
+public:
+	BinaryMask();
+	BinaryMask(Mat binary_image);
+	void pack(Mat binary_image);
+	void unpack(Mat& binary_image);
+	void erode(int radius);
+	void dilate(int radius);
+	void open(int radius);
+	void close(int radius);
+	int rows();
+	int columns();
+	int countObjectPixels(int row, int start_column, int end_column);
+};
 
-	// Backproject piece and square samples onto source.
-	Mat white_pieces_probs = BackProjection(source_image, white_pieces_image);
-	Mat black_pieces_probs = BackProjection(source_image, black_pieces_image);
-	Mat white_squares_probs = BackProjection(source_image, white_squares_image);
-	Mat black_squares_probs = BackProjection(source_image, black_squares_image);
-	Mat pieces_probs = JoinImagesHorizontally(white_pieces_probs, "white pieces", black_pieces_probs, "black pieces", 4, 255);
-	Mat squares_probs = JoinImagesHorizontally(white_squares_probs, "white squares", black_squares_probs, "black squares", 4, 255);
-	Mat backprojections = JoinImagesVertically(pieces_probs, "", squares_probs, "", 4, 255);
-	displayImage("Backprojections", backprojections);
+BinaryMask::BinaryMask()
+{
+	mRows = 0;
+	mColumns = 0;
+	mWordsPerRow = 0;
+	mLastWordMask = 0;
+}
 
-	// Compare probability images to classify image.
-	const Vec3b WHITE = { 255, 255, 255 };
-	const Vec3b BLACK = { 0, 0, 0 };
-	const Vec3b RED = { 0, 0, 255 };
-	const Vec3b GREEN = { 0, 255, 0};
-	const Vec3b BLUE = { 255, 0, 0 };
-	Mat classification_image = Mat::zeros(source_image.size(), CV_8UC3);
-	for (int i = 0; i < classification_image.rows; i++)
-	{
-		for (int j = 0; j < classification_image.cols; j++)
-		{
-			int black_pieces_prob = black_pieces_probs.at<uchar>(i, j);
-			int white_pieces_prob = white_pieces_probs.at<uchar>(i, j);
-			int black_squares_prob = black_squares_probs.at<uchar>(i, j);
-			int white_squares_prob = white_squares_probs.at<uchar>(i, j);
-			int max_prob = max(max(max(black_pieces_prob, white_pieces_prob), black_squares_prob), white_squares_prob);
-			if (max_prob > 127)
-			{
-				if (max_prob == white_pieces_prob)
-				{
-					classification_image.at<Vec3b>(i, j) = WHITE;
-				}
-				else if (max_prob == black_pieces_prob)
-				{
-					classification_image.at<Vec3b>(i, j) = BLACK;
-				}
-				else if (max_prob == white_squares_prob)
-				{
-					classification_image.at<Vec3b>(i, j) = RED;
-				}
-				else if (max_prob == black_squares_prob)
-				{
-					classification_image.at<Vec3b>(i, j) = GREEN;
-				}
-			}
-			else // it's background
+BinaryMask::BinaryMask(Mat binary_image)
+{
+	pack(binary_image);
+}
+
+// Pack a binary image (any non-zero pixel is set).  Buffers are only reallocated if the image grows.
+void BinaryMask::pack(Mat binary_image)
+{
+	mRows = binary_image.rows;
+	mColumns = binary_image.cols;
+	mWordsPerRow = (mColumns + 63) / 64;
+	mLastWordMask = (mColumns % 64 == 0) ? ~(uint64)0 : (((uint64)1 << (mColumns % 64)) - 1);
+	mWords.resize(mRows * mWordsPerRow);
+	mTemporaryWords.resize(mRows * mWordsPerRow);
+	for (int row = 0; row < mRows; row++)
+	{
+		const uchar* pixels = binary_image.ptr<uchar>(row);
+		uint64* words = &mWords[row * mWordsPerRow];
+		for (int word = 0; word < mWordsPerRow; word++)
+		{
+			int end_column = min(64 * word + 64, mColumns);
+			uint64 bits = 0;
+			for (int column = 64 * word; column < end_column; column++)
 			{
-				classification_image.at<Vec3b>(i, j) = BLUE;
+				bits |= (uint64)(pixels[column] != 0) << (column - 64 * word);
 			}
+			words[word] = bits;
 		}
 	}
-	//displayImage("Classification Image", classification_image);
+}
 
-	// Load ground truth image.
-	string ground_truth_filename = "Media/DraughtsGame1Move0GroundTruth.png";
-	Mat ground_truth_image = imread(ground_truth_filename, -1);
-	if (ground_truth_image.empty())
+// Unpack into a binary image (0 or 255).
+void BinaryMask::unpack(Mat& binary_image)
+{
+	binary_image.create(mRows, mColumns, CV_8U);
+	for (int row = 0; row < mRows; row++)
 	{
-		cout << "Cannot open image file: " << ground_truth_filename << endl;
+		uchar* pixels = binary_image.ptr<uchar>(row);
+		const uint64* words = &mWords[row * mWordsPerRow];
+		for (int column = 0; column < mColumns; column++)
+		{
+			pixels[column] = ((words[column / 64] >> (column % 64)) & 1) ? 255 : 0;
+		}
 	}
-	cvtColor(ground_truth_image, ground_truth_image, COLOR_BGRA2BGR);
-
-	// Compare qualitatively with ground truth.
-	Mat difference_image;
-	absdiff(classification_image, ground_truth_image, difference_image);
-	//displayImage("Difference with Ground Truth", difference_image);
-	Mat binary_difference_image;
-	cvtColor(difference_image, binary_difference_image, COLOR_BGR2GRAY);
-	threshold(binary_difference_image, binary_difference_image, 30, 255, THRESH_BINARY);
-	//displayImage("Binary Difference with Ground Truth", binary_difference_image);
-
-	// Display results.
-	Mat classification_images = JoinImagesHorizontally(ground_truth_image, "Ground Truth", classification_image, "Classification", 4, -1);
-	cvtColor(binary_difference_image, binary_difference_image, COLOR_GRAY2BGR);
-	Mat difference_images = JoinImagesHorizontally(difference_image, "Difference with Ground Truth", binary_difference_image, "Binary Difference with Ground Truth", 4, -1);
-	Mat results = JoinImagesVertically(classification_images, "", difference_images, "", 4, 255);
-	displayImage("Classifying the pixels", results);
+}
 
-	// Compare quantitatively with ground truth.
-	int misclassifications = 0;
-	int white_piece_misclassifications = 0;
-	int black_piece_misclassifications = 0;
-	int white_square_misclassifications = 0;
-	int black_square_misclassifications = 0;
-	int background_misclassifications = 0;
-	for (int i = 0; i < classification_image.rows; i++)
+// Combine each pixel with its horizontal neighbours within the given radius (one pixel at a time).
+void BinaryMask::horizontalPass(int radius, bool dilation)
+{
+	const uint64 border = dilation ? 0 : ~(uint64)0;
+	uint64* previous_words = &mTemporaryWords[0];
+	for (int row = 0; row < mRows; row++)
 	{
-		for (int j = 0; j < classification_image.cols; j++)
+		uint64* words = &mWords[row * mWordsPerRow];
+		for (int step = 0; step < radius; step++)
 		{
-			Vec3b actual = ground_truth_image.at<Vec3b>(i, j);
-			Vec3b predicted = classification_image.at<Vec3b>(i, j); 
-			if (actual != predicted)
+			for (int word = 0; word < mWordsPerRow; word++)
 			{
-				if (actual == WHITE)
-				{
-					white_piece_misclassifications++;
-				}
-				else if (actual == BLACK)
-				{
-					black_piece_misclassifications++;
-				}
-				else if (actual == RED)
-				{
-					white_square_misclassifications++;
-				}
-				else if (actual == GREEN)
-				{
-					black_square_misclassifications++;
-				}
-				else if (actual == BLUE)
-				{
-					background_misclassifications++;
-				}
-				misclassifications++;
+				previous_words[word] = words[word];
+			}
+			// Bits beyond the last column take the border value.
+			previous_words[mWordsPerRow - 1] = (previous_words[mWordsPerRow - 1] & mLastWordMask) | (border & ~mLastWordMask);
+			for (int word = 0; word < mWordsPerRow; word++)
+			{
+				uint64 before = (word > 0) ? previous_words[word - 1] : border;
+				uint64 after = (word < mWordsPerRow - 1) ? previous_words[word + 1] : border;
+				uint64 left_neighbours = (previous_words[word] << 1) | (before >> 63);
+				uint64 right_neighbours = (previous_words[word] >> 1) | (after << 63);
+				words[word] = dilation ? (previous_words[word] | left_neighbours | right_neighbours)
+					: (previous_words[word] & left_neighbours & right_neighbours);
 			}
+			words[mWordsPerRow - 1] &= mLastWordMask;
 		}
 	}
-	cout << "Misclassifications\n" 
-		<< "\tWhite pieces: " << white_piece_misclassifications
-		<< "\n\tBlack pieces: " << black_piece_misclassifications
-		<< "\n\tWhite squares: " << white_square_misclassifications
-		<< "\n\tBlack squares: " << black_square_misclassifications 
-		<< "\n\tBackground: " << background_misclassifications
-		<< "\nTotal: " << misclassifications << endl;
 }
 
-void part2(Mat empty_board_image, int confusion_matrix[3][3], Mat white_pieces_image, Mat black_pieces_image)
+// Combine each pixel with its vertical neighbours within the given radius.
+void BinaryMask::verticalPass(int radius, bool dilation)
 {
-	// Perform perspective transformation on empty board.
-	Mat empty_board_pt = perspectiveTransformation(empty_board_image);
-	
-	// Otsu Threshold empty board image.
-	Mat grey_board_image;
-	cvtColor(empty_board_pt, grey_board_image, COLOR_BGR2GRAY);
-	Mat thresholded_board_image;
-	threshold(grey_board_image, thresholded_board_image, 127, 255, THRESH_BINARY | THRESH_OTSU);
-	//displayImage("Thresholded Board Image", thresholded_board_image);
-
-	// Tidy with opening to get binary empty board.
-	Mat binary_empty_board = opening(thresholded_board_image, getStructuringElement5x5());
-	//displayImage("Binary Empty Board", binary_empty_board);
-
-	// Process all static images.
-	for (int image_index = 0; image_index < NUMBER_OF_STATIC_IMAGES; image_index++)
+	const uint64 border = dilation ? 0 : ~(uint64)0;
+	mTemporaryWords.swap(mWords);
+	for (int row = 0; row < mRows; row++)
 	{
-		// Load current board image.
-		string filename = "Media/" + GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][0];
-		Mat current_board_image = imread(filename, -1);
-		if (current_board_image.empty())
+		uint64* words = &mWords[row * mWordsPerRow];
+		for (int word = 0; word < mWordsPerRow; word++)
 		{
-			cout << "Cannot open image file: " << filename << endl;
-		}
-		//displayImage("Board", current_board_image);
-
-		// Perform perspective transformation on current board.
-		Mat current_board_pt = perspectiveTransformation(current_board_image);
-		//displayImage("Board Perspective Transformation",current_board_pt);
-
-		// Find difference between empty board and current board (static background model).
-		Mat difference;
-		absdiff(current_board_pt, empty_board_pt, difference);
-		cvtColor(difference, difference, COLOR_BGR2GRAY);
-		threshold(difference, difference, 30, 255, THRESH_BINARY);
-		//displayImage("Difference", difference);
-		Mat difference_transformed;
-		difference_transformed = opening(difference, getStructuringElement3x3());
-		difference_transformed = dilate(difference_transformed, getStructuringElement5x5());
-		difference_transformed = dilate(difference_transformed, getStructuringElement5x5());
-		//displayImage("Difference with Geometric Operations", difference_transformed);
-
-		// Get pieces using difference image as mask.
-		Mat pieces_image = Mat::zeros(difference.size(), CV_8UC3);
-		current_board_pt.copyTo(pieces_image, difference_transformed);
-		//displayImage("Pieces", pieces_image);
-
-		// Display results.
-		/*Mat display_image1 = difference.clone();
-		cvtColor(display_image1, display_image1, COLOR_GRAY2BGR);
-		Mat display_image2 = difference_transformed.clone();
-		cvtColor(display_image2, display_image2, COLOR_GRAY2BGR);
-		Mat img1 = JoinImagesHorizontally(current_board_pt, "Board Perspective Transformation", display_image1, "Difference", 4, -1);
-		Mat img2 = JoinImagesHorizontally(display_image2, "Difference with Geometric Operations", pieces_image, "Pieces", 4, -1);
-		Mat results = JoinImagesVertically(img1, "", img2, "", 4, 255);
-		displayImage("Identifying the squares and pieces", results);*/		
-
-		// Identify pieces in squares.
-		int square_number = 1;
-		for (int i = 0; i < 8; i++)
-		{
-			for (int j = 0; j < 8; j++)
+			uint64 bits = mTemporaryWords[row * mWordsPerRow + word];
+			for (int offset = 1; offset <= radius; offset++)
 			{
-				if (isBlackSquare(i * 50, j * 50))
-				{
-					int actual_square_contents = checkBoardGroundTruth(square_number, GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][1], GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][2]);
-					if (isPieceInSquare(difference_transformed, i * 50, j * 50))
-					{
-						if (isBlackPiece(pieces_image, i * 50, j * 50))
-						{
-							updateConfusionMatrix(confusion_matrix, BLACK_MAN_ON_SQUARE, actual_square_contents);
-						}
-						else // it's a white piece
-						{
-							updateConfusionMatrix(confusion_matrix, WHITE_MAN_ON_SQUARE, actual_square_contents);
-						}
-					}
-					else // it's empty
-					{
-						updateConfusionMatrix(confusion_matrix, EMPTY_SQUARE, actual_square_contents);
-					}
-					square_number++;
-				}
+				uint64 above = (row - offset >= 0) ? mTemporaryWords[(row - offset) * mWordsPerRow + word] : border;
+				uint64 below = (row + offset < mRows) ? mTemporaryWords[(row + offset) * mWordsPerRow + word] : border;
+				bits = dilation ? (bits | above | below) : (bits & above & below);
 			}
+			words[word] = bits;
 		}
+		words[mWordsPerRow - 1] &= mLastWordMask;
 	}
 }
 
-void part3(Mat empty_board_image, VideoCapture video)
+// Erode with a (2*radius+1) square structuring element.
+void BinaryMask::erode(int radius)
 {
-	// Perform perspective transformation on empty board.
-	Mat empty_board_pt = perspectiveTransformation(empty_board_image);
+	if ((mRows == 0) || (mColumns == 0))
+		return;
+	horizontalPass(radius, false);
+	verticalPass(radius, false);
+}
 
-	// Otsu Threshold empty board image.
-	Mat grey_board_image;
-	cvtColor(empty_board_pt, grey_board_image, COLOR_BGR2GRAY);
-	Mat thresholded_board_image;
-	threshold(grey_board_image, thresholded_board_image, 127, 255, THRESH_BINARY | THRESH_OTSU);
-	//DisplayImage("Thresholded Board Image", thresholded_board_image);
+// Dilate with a (2*radius+1) square structuring element.  Note that dilating twice with radius r is the same as once with radius 2r.
+void BinaryMask::dilate(int radius)
+{
+	if ((mRows == 0) || (mColumns == 0))
+		return;
+	horizontalPass(radius, true);
+	verticalPass(radius, true);
+}
 
-	// Tidy with opening to get binary empty board.
-	Mat binary_empty_board = opening(thresholded_board_image, getStructuringElement5x5());
-	//DisplayImage("Binary Empty Board", binary_empty_board);
-	
-	// Keep track of board state.
-	int piece_count = 24;
-	int previous_board[NUMBER_OF_SQUARES] = {
-		WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE,
-		WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE,
-		WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE, WHITE_MAN_ON_SQUARE,
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE,
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE,
-		BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE,
-		BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE,
-		BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE, BLACK_MAN_ON_SQUARE
-	};
-	int current_board[NUMBER_OF_SQUARES] = { 
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, 
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE,
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, 
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE,
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, 
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE,
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, 
-		EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE, EMPTY_SQUARE 
-	};
+// Open with a (2*radius+1) square structuring element.
+void BinaryMask::open(int radius)
+{
+	erode(radius);
+	dilate(radius);
+}
+
+// Close with a (2*radius+1) square structuring element.
+void BinaryMask::close(int radius)
+{
+	dilate(radius);
+	erode(radius);
+}
+
+int BinaryMask::rows()
+{
+	return mRows;
+}
+
+int BinaryMask::columns()
+{
+	return mColumns;
+}
+
+// Count the set pixels in part of a row.
+int BinaryMask::countObjectPixels(int row, int start_column, int end_column)
+{
+	const uint64* words = &mWords[row * mWordsPerRow];
+	int count = 0;
+	for (int word = start_column / 64; word * 64 < end_column; word++)
+	{
+		uint64 bits = words[word];
+		if (start_column > word * 64)
+			bits &= ~(uint64)0 << (start_column - word * 64);
+		if (end_column < word * 64 + 64)
+			bits &= ((uint64)1 << (end_column - word * 64)) - 1;
+		count += PopCount(bits);
+	}
+	return count;
+}
+
+// Struct to hold the intermediate buffers used when analysing frames, so that they are only allocated for the first frame.
+// Each thread which analyses frames needs its own workspace.
+struct FrameWorkspace
+{
+	// The bit-packed moving points (for the whole board, or for one square).
+	BinaryMask mask;
+	// The HSV conversion of the board.
+	Mat board_hsv;
+};
+
+// Class to classify pixels as white pieces, black pieces, white squares, black squares or background using colour samples.
+// The back projection of a sample's colour histogram depends only on which cell of the quantised BGR cube a pixel falls in,
+// so it is computed once per cell, and pixels are then classified with table lookups rather than four back projections.
+class ColourClassifier
+{
+private:
+	uchar mChannelCells[256];
+	// Unstretched back projection of each sample's histogram for each cell.
+	uchar mCellProbabilities[NUMBER_OF_COLOUR_SAMPLES][NUMBER_OF_COLOUR_CELLS];
+	Mat mCellImage;
+public:
+	ColourClassifier(Mat white_pieces_image, Mat black_pieces_image, Mat white_squares_image, Mat black_squares_image);
+	void classify(Mat bgr_image, Mat& class_image, Mat probability_images[NUMBER_OF_COLOUR_SAMPLES] = NULL, int probability_threshold = BACKGROUND_PROBABILITY_THRESHOLD);
+};
+
+ColourClassifier::ColourClassifier(Mat white_pieces_image, Mat black_pieces_image, Mat white_squares_image, Mat black_squares_image)
+{
+	// Channel values are binned as calcHist does for the range [0, 255).
+	for (int value = 0; value < 256; value++)
+	{
+		mChannelCells[value] = (uchar)min(cvFloor(value * (COLOUR_BINS / 255.0)), COLOUR_BINS);
+	}
+	// Back project the samples onto a palette with one colour from each cell.
+	Mat palette(1, NUMBER_OF_COLOUR_CELLS, CV_8UC3);
+	for (int value = 255; value >= 0; value--)
+	{
+		int cell = mChannelCells[value];
+		for (int other_cell1 = 0; other_cell1 < COLOUR_CELLS_PER_CHANNEL; other_cell1++)
+		{
+			for (int other_cell2 = 0; other_cell2 < COLOUR_CELLS_PER_CHANNEL; other_cell2++)
+			{
+				palette.at<Vec3b>(0, (cell * COLOUR_CELLS_PER_CHANNEL + other_cell1) * COLOUR_CELLS_PER_CHANNEL + other_cell2)[0] = (uchar)value;
+				palette.at<Vec3b>(0, (other_cell1 * COLOUR_CELLS_PER_CHANNEL + cell) * COLOUR_CELLS_PER_CHANNEL + other_cell2)[1] = (uchar)value;
+				palette.at<Vec3b>(0, (other_cell1 * COLOUR_CELLS_PER_CHANNEL + other_cell2) * COLOUR_CELLS_PER_CHANNEL + cell)[2] = (uchar)value;
+			}
+		}
+	}
+	Mat samples[NUMBER_OF_COLOUR_SAMPLES] = { white_pieces_image, black_pieces_image, white_squares_image, black_squares_image };
+	Mat probability_images[NUMBER_OF_COLOUR_SAMPLES];
+	MultiBackProjection(palette, samples, NUMBER_OF_COLOUR_SAMPLES, probability_images, COLOUR_BINS);
+	for (int sample = 0; sample < NUMBER_OF_COLOUR_SAMPLES; sample++)
+	{
+		const uchar* probabilities = probability_images[sample].ptr<uchar>(0);
+		for (int cell = 0; cell < NUMBER_OF_COLOUR_CELLS; cell++)
+		{
+			mCellProbabilities[sample][cell] = probabilities[cell];
+		}
+	}
+}
+
+// Classify each pixel of a BGR image into a class image (WHITE_PIECE_PIXEL ... BACKGROUND_PIXEL), giving the same result as
+// comparing the stretched back projections of the four samples.  Optionally also return the stretched back projections.
+void ColourClassifier::classify(Mat bgr_image, Mat& class_image, Mat probability_images[NUMBER_OF_COLOUR_SAMPLES], int probability_threshold)
+{
+	CV_Assert(bgr_image.type() == CV_8UC3);
+	mCellImage.create(bgr_image.size(), CV_32SC1);
+	// Find the cells in parallel over horizontal stripes, each noting which cells are present in it.
+	int number_of_stripes = NumberOfRowStripes(bgr_image.rows);
+	vector<uchar> stripe_cell_present(number_of_stripes * NUMBER_OF_COLOUR_CELLS, 0);
+	parallel_for_(Range(0, number_of_stripes), [&](const Range& stripes)
+	{
+		for (int stripe = stripes.start; stripe < stripes.end; stripe++)
+		{
+			uchar* cell_present = &stripe_cell_present[stripe * NUMBER_OF_COLOUR_CELLS];
+			Range rows = RowStripe(bgr_image.rows, stripe, number_of_stripes);
+			for (int row = rows.start; row < rows.end; row++)
+			{
+				const uchar* pixels = bgr_image.ptr<uchar>(row);
+				int* cells = mCellImage.ptr<int>(row);
+				for (int column = 0; column < bgr_image.cols; column++, pixels += 3)
+				{
+					int cell = (mChannelCells[pixels[0]] * COLOUR_CELLS_PER_CHANNEL + mChannelCells[pixels[1]]) * COLOUR_CELLS_PER_CHANNEL + mChannelCells[pixels[2]];
+					cells[column] = cell;
+					cell_present[cell] = 1;
+				}
+			}
+		}
+	});
+	bool cell_present[NUMBER_OF_COLOUR_CELLS] = { false };
+	for (int stripe = 0; stripe < number_of_stripes; stripe++)
+	{
+		for (int cell = 0; cell < NUMBER_OF_COLOUR_CELLS; cell++)
+		{
+			if (stripe_cell_present[stripe * NUMBER_OF_COLOUR_CELLS + cell])
+				cell_present[cell] = true;
+		}
+	}
+	// Each back projection is stretched by its maximum over the image (as StretchImage does), i.e. over the cells present.
+	int maximum_probabilities[NUMBER_OF_COLOUR_SAMPLES] = { 0 };
+	for (int cell = 0; cell < NUMBER_OF_COLOUR_CELLS; cell++)
+	{
+		if (cell_present[cell])
+		{
+			for (int sample = 0; sample < NUMBER_OF_COLOUR_SAMPLES; sample++)
+			{
+				maximum_probabilities[sample] = max(maximum_probabilities[sample], (int)mCellProbabilities[sample][cell]);
+			}
+		}
+	}
+	int stretched_probabilities[NUMBER_OF_COLOUR_SAMPLES][NUMBER_OF_COLOUR_CELLS];
+	int cell_classes[NUMBER_OF_COLOUR_CELLS];
+	for (int cell = 0; cell < NUMBER_OF_COLOUR_CELLS; cell++)
+	{
+		// The first of the samples with the highest probability wins, and pixels are background unless that probability is over the threshold.
+		int best_probability = 0;
+		cell_classes[cell] = BACKGROUND_PIXEL;
+		for (int sample = 0; sample < NUMBER_OF_COLOUR_SAMPLES; sample++)
+		{
+			// A back projection which is zero everywhere stays zero.
+			int probability = (maximum_probabilities[sample] > 0) ? (255 * mCellProbabilities[sample][cell]) / maximum_probabilities[sample] : 0;
+			stretched_probabilities[sample][cell] = probability;
+			if (probability > best_probability)
+			{
+				best_probability = probability;
+				cell_classes[cell] = sample;
+			}
+		}
+		if (best_probability <= probability_threshold)
+			cell_classes[cell] = BACKGROUND_PIXEL;
+	}
+	TableLookup(mCellImage, cell_classes, class_image);
+	if (probability_images != NULL)
+	{
+		for (int sample = 0; sample < NUMBER_OF_COLOUR_SAMPLES; sample++)
+		{
+			TableLookup(mCellImage, stretched_probabilities[sample], probability_images[sample]);
+		}
+	}
+}
+
+// Colours used for each pixel class (WHITE_PIECE_PIXEL ... BACKGROUND_PIXEL) in classification and ground truth images.
+const Vec3b PIXEL_CLASS_COLOURS[NUMBER_OF_PIXEL_CLASSES] = { Vec3b(255, 255, 255), Vec3b(0, 0, 0), Vec3b(0, 0, 255), Vec3b(0, 255, 0), Vec3b(255, 0, 0) };
+
+// Struct to hold the results of comparing pixel classes with ground truth over one or more labelled images.
+struct PixelClassMetrics
+{
+	// Pixels counted by detected class (rows) and ground truth class (columns), with a final column for unlabelled ground truth.
+	long long confusion_matrix[NUMBER_OF_PIXEL_CLASSES][NUMBER_OF_PIXEL_CLASSES + 1];
+	PixelClassMetrics();
+	void add(PixelClassMetrics& other);
+	long long getMisclassifications(int actual_class);
+	long long getMisclassifications();
+	double getPrecision(int pixel_class);
+	double getRecall(int pixel_class);
+	double getIntersectionOverUnion(int pixel_class);
+};
+
+PixelClassMetrics::PixelClassMetrics()
+{
+	for (int detected_class = 0; detected_class < NUMBER_OF_PIXEL_CLASSES; detected_class++)
+		for (int actual_class = 0; actual_class <= NUMBER_OF_PIXEL_CLASSES; actual_class++)
+			confusion_matrix[detected_class][actual_class] = 0;
+}
+
+void PixelClassMetrics::add(PixelClassMetrics& other)
+{
+	for (int detected_class = 0; detected_class < NUMBER_OF_PIXEL_CLASSES; detected_class++)
+		for (int actual_class = 0; actual_class <= NUMBER_OF_PIXEL_CLASSES; actual_class++)
+			confusion_matrix[detected_class][actual_class] += other.confusion_matrix[detected_class][actual_class];
+}
+
+// Number of pixels of the given ground truth class which were detected as another class.
+long long PixelClassMetrics::getMisclassifications(int actual_class)
+{
+	long long misclassifications = 0;
+	for (int detected_class = 0; detected_class < NUMBER_OF_PIXEL_CLASSES; detected_class++)
+		if (detected_class != actual_class)
+			misclassifications += confusion_matrix[detected_class][actual_class];
+	return misclassifications;
+}
+
+// Number of pixels which do not match the ground truth (including all unlabelled pixels).
+long long PixelClassMetrics::getMisclassifications()
+{
+	long long misclassifications = 0;
+	for (int actual_class = 0; actual_class < NUMBER_OF_PIXEL_CLASSES; actual_class++)
+		misclassifications += getMisclassifications(actual_class);
+	for (int detected_class = 0; detected_class < NUMBER_OF_PIXEL_CLASSES; detected_class++)
+		misclassifications += confusion_matrix[detected_class][NUMBER_OF_PIXEL_CLASSES];
+	return misclassifications;
+}
+
+// Fraction of the (labelled) pixels detected as the class which are that class.
+double PixelClassMetrics::getPrecision(int pixel_class)
+{
+	long long detected = 0;
+	for (int actual_class = 0; actual_class < NUMBER_OF_PIXEL_CLASSES; actual_class++)
+		detected += confusion_matrix[pixel_class][actual_class];
+	return (detected > 0) ? ((double)confusion_matrix[pixel_class][pixel_class]) / detected : 0.0;
+}
+
+// Fraction of the pixels of the class which were detected as that class.
+double PixelClassMetrics::getRecall(int pixel_class)
+{
+	long long actual = 0;
+	for (int detected_class = 0; detected_class < NUMBER_OF_PIXEL_CLASSES; detected_class++)
+		actual += confusion_matrix[detected_class][pixel_class];
+	return (actual > 0) ? ((double)confusion_matrix[pixel_class][pixel_class]) / actual : 0.0;
+}
+
+// Intersection over union of the (labelled) pixels detected as the class and the pixels of the class.
+double PixelClassMetrics::getIntersectionOverUnion(int pixel_class)
+{
+	long long both = confusion_matrix[pixel_class][pixel_class];
+	long long either = -both;
+	for (int other_class = 0; other_class < NUMBER_OF_PIXEL_CLASSES; other_class++)
+		either += confusion_matrix[pixel_class][other_class] + confusion_matrix[other_class][pixel_class];
+	return (either > 0) ? ((double)both) / either : 0.0;
+}
+
+// Convert a colour classification or ground truth image to pixel class labels, with colours which are not class colours
+// labelled UNLABELLED_PIXEL.
+void colourToLabels(Mat colour_image, Mat& label_image)
+{
+	CV_Assert(colour_image.type() == CV_8UC3);
+	label_image.create(colour_image.size(), CV_8UC1);
+	parallel_for_(Range(0, colour_image.rows), [&](const Range& rows)
+	{
+		for (int row = rows.start; row < rows.end; row++)
+		{
+			const Vec3b* colours = colour_image.ptr<Vec3b>(row);
+			uchar* labels = label_image.ptr<uchar>(row);
+			for (int column = 0; column < colour_image.cols; column++)
+			{
+				labels[column] = UNLABELLED_PIXEL;
+				for (int pixel_class = 0; pixel_class < NUMBER_OF_PIXEL_CLASSES; pixel_class++)
+				{
+					if (colours[column] == PIXEL_CLASS_COLOURS[pixel_class])
+					{
+						labels[column] = (uchar)pixel_class;
+						break;
+					}
+				}
+			}
+		}
+	});
+}
+
+// Compare detected pixel class labels with ground truth labels, adding to the confusion matrix.  Each pixel is counted with a
+// single increment indexed by its (detected, ground truth) pair, in parallel over horizontal stripes whose counts are added in stripe order.
+void evaluatePixelLabels(Mat detected_labels, Mat ground_truth_labels, PixelClassMetrics& metrics)
+{
+	CV_Assert((detected_labels.type() == CV_8UC1) && (ground_truth_labels.type() == CV_8UC1) && (detected_labels.size() == ground_truth_labels.size()));
+	const int NUMBER_OF_PAIRS = NUMBER_OF_PIXEL_CLASSES * (NUMBER_OF_PIXEL_CLASSES + 1);
+	int number_of_stripes = NumberOfRowStripes(detected_labels.rows);
+	vector<long long> stripe_counts(number_of_stripes * NUMBER_OF_PAIRS, 0);
+	parallel_for_(Range(0, number_of_stripes), [&](const Range& stripes)
+	{
+		for (int stripe = stripes.start; stripe < stripes.end; stripe++)
+		{
+			long long* counts = &stripe_counts[stripe * NUMBER_OF_PAIRS];
+			Range rows = RowStripe(detected_labels.rows, stripe, number_of_stripes);
+			for (int row = rows.start; row < rows.end; row++)
+			{
+				const uchar* detected_row = detected_labels.ptr<uchar>(row);
+				const uchar* actual_row = ground_truth_labels.ptr<uchar>(row);
+				for (int column = 0; column < detected_labels.cols; column++)
+				{
+					counts[min((int)detected_row[column], NUMBER_OF_PIXEL_CLASSES - 1) * (NUMBER_OF_PIXEL_CLASSES + 1) + min((int)actual_row[column], NUMBER_OF_PIXEL_CLASSES)]++;
+				}
+			}
+		}
+	});
+	for (int stripe = 0; stripe < number_of_stripes; stripe++)
+		for (int pair = 0; pair < NUMBER_OF_PAIRS; pair++)
+			metrics.confusion_matrix[pair / (NUMBER_OF_PIXEL_CLASSES + 1)][pair % (NUMBER_OF_PIXEL_CLASSES + 1)] += stripe_counts[stripe * NUMBER_OF_PAIRS + pair];
+}
+
+// Compare many labelled frames in parallel (one frame per task), adding the results for each frame in frame order.
+void evaluatePixelLabels(vector<Mat>& detected_labels, vector<Mat>& ground_truth_labels, PixelClassMetrics& metrics)
+{
+	CV_Assert(detected_labels.size() == ground_truth_labels.size());
+	vector<PixelClassMetrics> frame_metrics(detected_labels.size());
+	parallel_for_(Range(0, (int)detected_labels.size()), [&](const Range& frames)
+	{
+		for (int frame = frames.start; frame < frames.end; frame++)
+		{
+			evaluatePixelLabels(detected_labels[frame], ground_truth_labels[frame], frame_metrics[frame]);
+		}
+	});
+	for (size_t frame = 0; frame < frame_metrics.size(); frame++)
+		metrics.add(frame_metrics[frame]);
+}
+
+// Print the confusion matrix and the per class precision, recall and intersection over union.
+void printPixelClassMetrics(PixelClassMetrics& metrics)
+{
+	const string CLASS_NAMES[NUMBER_OF_PIXEL_CLASSES] = { "WP", "BP", "WS", "BS", "BG" };
+	cout << "Pixel Confusion Matrix:\n";
+	for (int actual_class = 0; actual_class < NUMBER_OF_PIXEL_CLASSES; actual_class++)
+		cout << "\tGT_" << CLASS_NAMES[actual_class];
+	cout << "\tGT_None\n";
+	for (int detected_class = 0; detected_class < NUMBER_OF_PIXEL_CLASSES; detected_class++)
+	{
+		cout << "D_" << CLASS_NAMES[detected_class];
+		for (int actual_class = 0; actual_class <= NUMBER_OF_PIXEL_CLASSES; actual_class++)
+			cout << "\t" << metrics.confusion_matrix[detected_class][actual_class];
+		cout << "\n";
+	}
+	cout << "\tPrecision\tRecall\tIoU\n";
+	for (int pixel_class = 0; pixel_class < NUMBER_OF_PIXEL_CLASSES; pixel_class++)
+	{
+		cout << CLASS_NAMES[pixel_class] << "\t" << metrics.getPrecision(pixel_class) << "\t\t" << metrics.getRecall(pixel_class)
+			<< "\t" << metrics.getIntersectionOverUnion(pixel_class) << "\n";
+	}
+	cout.flush();
+}
+
+// Struct to hold the parameters used when classifying the squares in the static images (see SweepStillImageParameters).
+struct StillImageParameters
+{
+	// Threshold on the (grey level) difference from the empty board for moving points.
+	int difference_threshold;
+	// Fraction of a square which must be moving points for it to contain a piece.
+	float occupancy_threshold;
+	// Pieces whose outline has a lower circularity are kings.
+	double king_circularity_threshold;
+	// Number of bins in the hue histograms used to decide the colour of pieces.
+	int hue_bins;
+
+	StillImageParameters()
+	{
+		this->difference_threshold = DIFFERENCE_THRESHOLD;
+		this->occupancy_threshold = OCCUPANCY_THRESHOLD;
+		this->king_circularity_threshold = KING_CIRCULARITY_THRESHOLD;
+		this->hue_bins = PIECE_COLOUR_HUE_BINS;
+	}
+};
+
+// Struct to hold one of the static board images once it has been decoded, warped and compared with the empty board, which is
+// shared by all of the classifiers registered with a StillImageEvaluator.
+struct StillImage
+{
+	// The index of the image in GROUND_TRUTH_FOR_BOARD_IMAGES.
+	int image_index;
+	// The parameters with which the image is processed and classified.
+	StillImageParameters parameters;
+	// The perspective transformed board.
+	Mat board_pt;
+	// The moving points after an opening (3x3) and two dilations (5x5, performed as a single 9x9 dilation).
+	BinaryMask dilated_mask;
+	Mat dilated_points;
+	// The moving points after a further closing (3x3).
+	BinaryMask closed_mask;
+	Mat closed_points;
+};
+
+// Abstract class for a classifier of the squares in the static board images.  classifyStill() is called for different images
+// from several threads at once, so it should only record the results for that image, and these are combined in image order by finish().
+class StillImageClassifier
+{
+public:
+	virtual ~StillImageClassifier() {}
+	virtual void classifyStill(StillImage& still) = 0;
+	virtual void finish() {}
+};
+
+// Classifier which adds up a confusion matrix over the static images, using a function which updates a confusion matrix
+// for the squares of one image (such as part2 or part5).
+template <int NUMBER_OF_CLASSES>
+class ConfusionMatrixClassifier : public StillImageClassifier
+{
+private:
+	typedef void (*ClassifyFunction)(StillImage& still, int confusion_matrix[NUMBER_OF_CLASSES][NUMBER_OF_CLASSES]);
+	ClassifyFunction mClassify;
+	int (*mConfusionMatrix)[NUMBER_OF_CLASSES];
+	int mImageConfusionMatrices[NUMBER_OF_STATIC_IMAGES][NUMBER_OF_CLASSES][NUMBER_OF_CLASSES];
+public:
+	ConfusionMatrixClassifier(ClassifyFunction classify, int confusion_matrix[NUMBER_OF_CLASSES][NUMBER_OF_CLASSES]) :
+		mClassify(classify), mConfusionMatrix(confusion_matrix), mImageConfusionMatrices() {}
+	void classifyStill(StillImage& still)
+	{
+		mClassify(still, mImageConfusionMatrices[still.image_index]);
+	}
+	void finish()
+	{
+		for (int image_index = 0; image_index < NUMBER_OF_STATIC_IMAGES; image_index++)
+			for (int detected = 0; detected < NUMBER_OF_CLASSES; detected++)
+				for (int actual = 0; actual < NUMBER_OF_CLASSES; actual++)
+					mConfusionMatrix[detected][actual] += mImageConfusionMatrices[image_index][detected][actual];
+	}
+};
+
+// Class to evaluate the registered classifiers on all of the static board images, with each image only being decoded, warped and
+// compared with the empty board once however many classifiers there are.  The warped boards are cached on disk (in
+// WARPED_BOARD_CACHE_DIRECTORY) as raw images, keyed by the contents of the image file, the warp parameters and
+// WARPED_BOARD_CACHE_VERSION, so that later evaluations do not need to decode or warp the images at all (unless the
+// DISABLE_WARPED_BOARD_CACHE_VARIABLE environment variable is set).  The board corners are scaled from the reference frame to the
+// size of each image, and JPEG stills on which the board is much larger than the warped board are decoded at a reduced scale.
+class StillImageEvaluator
+{
+private:
+	// Warp (and its hash) for images of one size decoded at one scale.
+	struct ScaledBoardWarp
+	{
+		Size image_size;
+		int scale_index;
+		BoardWarp board_warp;
+		uint64 hash;
+	};
+	// The warps for the image sizes and scales met so far (which may be added to while images are preprocessed in parallel).
+	vector<ScaledBoardWarp> mBoardWarps;
+	std::mutex mBoardWarpsMutex;
+	bool mUseCache;
+	Mat mEmptyBoardPt;
+	vector<StillImageClassifier*> mClassifiers;
+	void getBoardCorners(Size image_size, int scale_index, Point2f corners[4]);
+	int getDecodeScaleIndex(Size image_size);
+	ScaledBoardWarp getBoardWarp(Size image_size, int scale_index);
+	void loadWarpedBoard(string filename, Mat& board_pt);
+	void preprocess(int image_index, StillImage& still);
+public:
+	StillImageEvaluator(Mat empty_board_image);
+	void registerClassifier(StillImageClassifier* classifier);
+	void evaluate();
+	void loadDifference(int image_index, Mat& board_pt, Mat& grey_difference);
+	void findMovingPoints(Mat binary_difference, StillImage& still);
+};
+
+StillImageEvaluator::StillImageEvaluator(Mat empty_board_image)
+{
+	// Perform perspective transformation on empty board.
+	getBoardWarp(empty_board_image.size(), 0).board_warp.warp(empty_board_image, mEmptyBoardPt);
+	mUseCache = (getenv(DISABLE_WARPED_BOARD_CACHE_VARIABLE) == NULL);
+	if (mUseCache)
+	{
+		std::error_code error;
+		create_directories(WARPED_BOARD_CACHE_DIRECTORY, error);
+	}
+}
+
+void StillImageEvaluator::registerClassifier(StillImageClassifier* classifier)
+{
+	mClassifiers.push_back(classifier);
+}
+
+// Get the board corners in an image of the given size decoded at the given scale, scaling BOARD_CORNERS from the reference frame.
+// The pixel centres of an image scaled by s are at ((x + 0.5) * s - 0.5, (y + 0.5) * s - 0.5) in it.
+void StillImageEvaluator::getBoardCorners(Size image_size, int scale_index, Point2f corners[4])
+{
+	float scale_x = (float)image_size.width / (REFERENCE_FRAME_WIDTH * DECODE_SCALES[scale_index]);
+	float scale_y = (float)image_size.height / (REFERENCE_FRAME_HEIGHT * DECODE_SCALES[scale_index]);
+	for (int corner = 0; corner < 4; corner++)
+	{
+		corners[corner] = Point2f((BOARD_CORNERS[corner].x + 0.5f) * scale_x - 0.5f, (BOARD_CORNERS[corner].y + 0.5f) * scale_y - 0.5f);
+	}
+}
+
+// Choose the smallest scale at which a JPEG still of the given size can be decoded with every edge of the board still at least
+// BOARD_DIMENSIONS_IN_PIXELS long (so that the warped board is still oversampled).  Stills of the reference frame size (such as
+// those in Media) are always decoded at full scale, as the shortest edge of the board in them is only about 234 pixels.
+int StillImageEvaluator::getDecodeScaleIndex(Size image_size)
+{
+	// The corners are in the order top left, bottom left, top right, bottom right.
+	Point2f corners[4];
+	getBoardCorners(image_size, 0, corners);
+	double shortest_board_edge = min(min(DistanceBetweenPoints(Point2d(corners[0]), Point2d(corners[1])), DistanceBetweenPoints(Point2d(corners[0]), Point2d(corners[2]))),
+		min(DistanceBetweenPoints(Point2d(corners[1]), Point2d(corners[3])), DistanceBetweenPoints(Point2d(corners[2]), Point2d(corners[3]))));
+	int scale_index = 0;
+	while ((scale_index + 1 < NUMBER_OF_DECODE_SCALES) && (shortest_board_edge / DECODE_SCALES[scale_index + 1] >= BOARD_DIMENSIONS_IN_PIXELS))
+		scale_index++;
+	return scale_index;
+}
+
+// Get the warp for images of the given (full scale) size decoded at the given scale, computing it the first time it is needed.
+StillImageEvaluator::ScaledBoardWarp StillImageEvaluator::getBoardWarp(Size image_size, int scale_index)
+{
+	std::lock_guard<std::mutex> lock(mBoardWarpsMutex);
+	for (ScaledBoardWarp& scaled_board_warp : mBoardWarps)
+	{
+		if ((scaled_board_warp.image_size == image_size) && (scaled_board_warp.scale_index == scale_index))
+			return scaled_board_warp;
+	}
+	ScaledBoardWarp scaled_board_warp;
+	Point2f corners[4];
+	getBoardCorners(image_size, scale_index, corners);
+	scaled_board_warp.image_size = image_size;
+	scaled_board_warp.scale_index = scale_index;
+	scaled_board_warp.board_warp = BoardWarp(corners);
+	scaled_board_warp.hash = scaled_board_warp.board_warp.getParametersHash();
+	mBoardWarps.push_back(scaled_board_warp);
+	return scaled_board_warp;
+}
+
+// Load the warped board for an image file from the cache or, if it is not there (or is out of date), decode and warp the image
+// and add it to the cache.  The size of JPEG stills is read from their header so that they need not be decoded to choose the warp.
+void StillImageEvaluator::loadWarpedBoard(string filename, Mat& board_pt)
+{
+	Size image_size;
+	Mat current_board_image;
+	int scale_index = 0;
+	if (ReadJpegSize(filename, image_size))
+	{
+		scale_index = getDecodeScaleIndex(image_size);
+	}
+	else
+	{
+		current_board_image = imread(filename, DECODE_SCALE_FLAGS[scale_index]);
+		image_size = current_board_image.size();
+	}
+	ScaledBoardWarp scaled_board_warp = getBoardWarp(image_size, scale_index);
+	uint64 key = FNV_OFFSET_BASIS;
+	bool hashed = mUseCache && HashFile(filename, key);
+	int version = WARPED_BOARD_CACHE_VERSION;
+	key = HashBytes(&version, sizeof(version), key);
+	key = HashBytes(&scaled_board_warp.hash, sizeof(scaled_board_warp.hash), key);
+	string cache_filename = string(WARPED_BOARD_CACHE_DIRECTORY) + "/" + format("%016llx.raw", (unsigned long long)key);
+	if (hashed && ReadRawImage(cache_filename, key, Size(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS), CV_8UC3, board_pt))
+		return;
+
+	// Load current board image (at the chosen scale).
+	if (current_board_image.empty())
+		current_board_image = imread(filename, DECODE_SCALE_FLAGS[scale_index]);
+	if (current_board_image.empty())
+	{
+		cout << "Cannot open image file: " << filename << endl;
+	}
+	//displayImage("Board", current_board_image);
+
+	// Perform perspective transformation on current board.
+	scaled_board_warp.board_warp.warp(current_board_image, board_pt);
+	if (hashed)
+		WriteRawImage(cache_filename, key, board_pt);
+}
+
+// Load a static image (warped), and find the points which differ from the empty board.
+void StillImageEvaluator::preprocess(int image_index, StillImage& still)
+{
+	still.image_index = image_index;
+	loadWarpedBoard(string("Media/") + GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][0], still.board_pt);
+	//displayImage("Board Perspective Transformation", still.board_pt);
+
+	// Find difference between empty board and current board (static background model).
+	Mat difference;
+	DifferenceThreshold(still.board_pt, mEmptyBoardPt, difference, still.parameters.difference_threshold);
+	//displayImage("Difference", difference);
+	findMovingPoints(difference, still);
+}
+
+// Load a static image (warped) and its grey level difference from the empty board, which can be thresholded (with
+// THRESH_BINARY) to give the same result as DifferenceThreshold at any threshold.
+void StillImageEvaluator::loadDifference(int image_index, Mat& board_pt, Mat& grey_difference)
+{
+	loadWarpedBoard(string("Media/") + GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][0], board_pt);
+	Mat difference;
+	absdiff(board_pt, mEmptyBoardPt, difference);
+	cvtColor(difference, grey_difference, COLOR_BGR2GRAY);
+}
+
+// Clean up the binary difference from the empty board to give the moving points (with and without a final closing) of a still.
+void StillImageEvaluator::findMovingPoints(Mat binary_difference, StillImage& still)
+{
+	// Opening (3x3) followed by two dilations (5x5), which are performed as a single 9x9 dilation.
+	still.dilated_mask.pack(binary_difference);
+	still.dilated_mask.open(1);
+	still.dilated_mask.dilate(4);
+	still.dilated_mask.unpack(still.dilated_points);
+	//displayImage("Difference with Geometric Operations", still.dilated_points);
+	// Closing (3x3) of the dilated points.
+	still.closed_mask = still.dilated_mask;
+	still.closed_mask.close(1);
+	still.closed_mask.unpack(still.closed_points);
+}
+
+// Evaluate the classifiers, processing all static images in parallel with each image being an independent task.
+void StillImageEvaluator::evaluate()
+{
+	parallel_for_(Range(0, NUMBER_OF_STATIC_IMAGES), [&](const Range& images)
+	{
+		StillImage still;
+		for (int image_index = images.start; image_index < images.end; image_index++)
+		{
+			preprocess(image_index, still);
+			for (StillImageClassifier* classifier : mClassifiers)
+			{
+				classifier->classifyStill(still);
+			}
+		}
+	});
+	for (StillImageClassifier* classifier : mClassifiers)
+	{
+		classifier->finish();
+	}
+}
+
+// Class to decide when the board has settled after motion (e.g. a hand making a move), from the motion energy (the mean absolute
+// grey level difference) between successive downsampled warped frames.  It moves from idle to motion when the energy exceeds
+// MOTION_ENERGY_THRESHOLD, to settling when it drops again, and to settled (for one frame, before going back to idle) once it has
+// stayed low for SETTLING_FRAMES frames, so the squares need only be classified once each time the board settles.  So that changes
+// without enough motion (e.g. a slow move) are not missed, it also counts as settled once it has been idle for MAXIMUM_IDLE_FRAMES.
+// The first frame always counts as settled.  Each thread which tracks frames needs its own gate.
+class MotionGate
+{
+private:
+	int mState;
+	int mQuietFrames;
+	int mIdleFrames;
+	Mat mColourThumbnail;
+	Mat mThumbnail;
+	Mat mPreviousThumbnail;
+public:
+	MotionGate();
+	bool update(Mat board_pt);
+	int getState();
+};
+
+MotionGate::MotionGate()
+{
+	mState = GATE_SETTLING;
+	mQuietFrames = SETTLING_FRAMES - 1;
+	mIdleFrames = 0;
+}
+
+// Update the gate with the next warped frame.  Returns true if the board has just settled.
+bool MotionGate::update(Mat board_pt)
+{
+	resize(board_pt, mColourThumbnail, Size(board_pt.cols / MOTION_DOWNSAMPLING, board_pt.rows / MOTION_DOWNSAMPLING), 0, 0, INTER_AREA);
+	cvtColor(mColourThumbnail, mThumbnail, COLOR_BGR2GRAY);
+	double motion_energy = mPreviousThumbnail.empty() ? 0.0 : norm(mThumbnail, mPreviousThumbnail, NORM_L1) / mThumbnail.total();
+	std::swap(mThumbnail, mPreviousThumbnail);
+	bool moving = (motion_energy > MOTION_ENERGY_THRESHOLD);
+	switch (mState)
+	{
+		case(GATE_IDLE):
+			if (moving)
+				mState = GATE_MOTION;
+			else if (++mIdleFrames >= MAXIMUM_IDLE_FRAMES)
+				mState = GATE_SETTLED;
+			break;
+		case(GATE_MOTION):
+			if (!moving)
+			{
+				mState = GATE_SETTLING;
+				mQuietFrames = 1;
+			}
+			break;
+		case(GATE_SETTLING):
+			if (moving)
+				mState = GATE_MOTION;
+			else if (++mQuietFrames >= SETTLING_FRAMES)
+				mState = GATE_SETTLED;
+			break;
+		case(GATE_SETTLED):
+			mState = (moving) ? GATE_MOTION : GATE_IDLE;
+			mIdleFrames = 1;
+			break;
+	}
+	return (mState == GATE_SETTLED);
+}
+
+int MotionGate::getState()
+{
+	return mState;
+}
+
+// Class to detect video frames which are (almost) the same as the last frame processed, from a signature of each frame (its
+// luminance downsampled to FRAME_SIGNATURE_SIZE x FRAME_SIGNATURE_SIZE), so that the analysis of that frame can be reused
+// without warping the frame.  Frames are compared with the last frame which was not a duplicate, so that slow changes
+// cannot accumulate unnoticed.  Each thread which tracks frames needs its own deduplicator.
+class FrameDeduplicator
+{
+private:
+	Mat mColourSignature;
+	Mat mSignature;
+	Mat mProcessedSignature;
+public:
+	bool isDuplicate(Mat frame);
+};
+
+// Check whether no part of the signature of a frame differs by more than FRAME_SIGNATURE_TOLERANCE grey levels from that of the
+// last frame processed.  If it does, the frame will be processed and so its signature is kept.
+bool FrameDeduplicator::isDuplicate(Mat frame)
+{
+	resize(frame, mColourSignature, Size(FRAME_SIGNATURE_SIZE, FRAME_SIGNATURE_SIZE), 0, 0, INTER_AREA);
+	cvtColor(mColourSignature, mSignature, COLOR_BGR2GRAY);
+	if (!mProcessedSignature.empty() && (norm(mSignature, mProcessedSignature, NORM_INF) <= FRAME_SIGNATURE_TOLERANCE))
+		return true;
+	std::swap(mSignature, mProcessedSignature);
+	return false;
+}
+
+// Class to detect the state of the board in video frames using the static background model.
+class BoardStateDetector
+{
+private:
+	BoardWarp mBoardWarp;
+	Mat mEmptyBoard;
+	bool mSparseSquares;
+	void warpBoard(FrameAnalysis& analysis);
+	void findMovingPointsInBoard(FrameAnalysis& analysis, FrameWorkspace& workspace);
+public:
+	BoardStateDetector(Mat empty_board_image, bool sparse_squares);
+	void findMovingPoints(FrameAnalysis& analysis, FrameWorkspace& workspace);
+	bool findMovingPoints(FrameAnalysis& analysis, FrameWorkspace& workspace, MotionGate& gate);
+	void reuseAnalysis(FrameAnalysis& analysis, FrameWorkspace& workspace, MotionGate* gate);
+	void classifySquares(FrameAnalysis& analysis, FrameWorkspace& workspace);
+};
+
+BoardStateDetector::BoardStateDetector(Mat empty_board_image, bool sparse_squares)
+{
+	mSparseSquares = sparse_squares;
+	// Perform perspective transformation on empty board.
+	if (mSparseSquares)
+	{
+		mBoardWarp.warpSquares(empty_board_image, mEmptyBoard);
+	}
+	else
+	{
+		mBoardWarp.warp(empty_board_image, mEmptyBoard);
+	}
+}
+
+// Warp the frame and find the points which differ from the empty board.
+void BoardStateDetector::findMovingPoints(FrameAnalysis& analysis, FrameWorkspace& workspace)
+{
+	warpBoard(analysis);
+	findMovingPointsInBoard(analysis, workspace);
+	analysis.settled = true;
+	analysis.duplicate = false;
+}
+
+// Warp the frame and update the motion gate with it, only finding the points which differ from the empty board if the board
+// has just settled.  Returns whether it has (i.e. whether the squares should be classified in this frame).
+bool BoardStateDetector::findMovingPoints(FrameAnalysis& analysis, FrameWorkspace& workspace, MotionGate& gate)
+{
+	warpBoard(analysis);
+	analysis.settled = gate.update(analysis.board_pt);
+	analysis.duplicate = false;
+	if (analysis.settled)
+		findMovingPointsInBoard(analysis, workspace);
+	return analysis.settled;
+}
+
+// Reuse the analysis of the last frame processed (still held in the analysis) for a duplicate of it, without warping the frame.
+// With the motion gate, the gate is still updated with the (unchanged) warped board, and if the board has just settled its
+// moving points are found so that it can be classified.
+void BoardStateDetector::reuseAnalysis(FrameAnalysis& analysis, FrameWorkspace& workspace, MotionGate* gate)
+{
+	analysis.duplicate = true;
+	if (gate == NULL)
+		return;
+	analysis.settled = gate->update(analysis.board_pt);
+	if (analysis.settled)
+	{
+		findMovingPointsInBoard(analysis, workspace);
+		analysis.duplicate = false;
+	}
+}
+
+// Perform perspective transformation on current board (or just on its dark squares).
+void BoardStateDetector::warpBoard(FrameAnalysis& analysis)
+{
+	if (mSparseSquares)
+	{
+		mBoardWarp.warpSquares(analysis.frame, analysis.board_pt);
+	}
+	else
+	{
+		mBoardWarp.warp(analysis.frame, analysis.board_pt);
+	}
+}
+
+// Find the points in the warped frame which differ from the empty board.
+void BoardStateDetector::findMovingPointsInBoard(FrameAnalysis& analysis, FrameWorkspace& workspace)
+{
+	// Find difference between empty board and current board (static background model).
+	Mat& moving_points = analysis.moving_points;
+	DifferenceThreshold(analysis.board_pt, mEmptyBoard, moving_points, DIFFERENCE_THRESHOLD);
+	if (mSparseSquares)
+	{
+		// Each square is processed as a separate image so that the squares do not bleed into each other.
+		// Note that this ignores the light squares, so results near the edges of squares can differ slightly from the full board.
+		for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+		{
+			Mat square_points(SQUARE_DIMENSIONS_IN_PIXELS, SQUARE_DIMENSIONS_IN_PIXELS, CV_8U, getSquareImage(moving_points, square_number).data);
+			workspace.mask.pack(square_points);
+			workspace.mask.open(1);
+			workspace.mask.dilate(4);
+			workspace.mask.unpack(square_points);
+		}
+		analysis.object_pixels = getSquareOccupancy(moving_points, analysis.occupancy);
+	}
+	else
+	{
+		// Opening (3x3) followed by two dilations (5x5), which are performed as a single 9x9 dilation.
+		workspace.mask.pack(moving_points);
+		workspace.mask.open(1);
+		workspace.mask.dilate(4);
+		workspace.mask.unpack(moving_points);
+		analysis.object_pixels = getSquareOccupancy(workspace.mask, analysis.occupancy);
+	}
+	//displayImage("moving", moving_points);
+	//cout << "Frame " << analysis.frame_number << " object Pixels: " << analysis.object_pixels << endl;
+}
+
+// Detect the state of each square of the board.
+void BoardStateDetector::classifySquares(FrameAnalysis& analysis, FrameWorkspace& workspace)
+{
+	// Get the colours of the pieces (using difference image as mask).
+	bool is_black_piece[NUMBER_OF_SQUARES];
+	getPieceColours(analysis.board_pt, analysis.moving_points, workspace.board_hsv, is_black_piece, analysis.colour_margin);
+
+	// Detect state of current board.
+	analysis.detected_piece_count = 0;
+	for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+	{
+		if (isPieceInSquare(analysis.occupancy[square_number - 1]))
+		{
+			if (is_black_piece[square_number - 1])
+			{
+				analysis.board[square_number - 1] = BLACK_MAN_ON_SQUARE;
+			}
+			else // it's a white piece
+			{
+				analysis.board[square_number - 1] = WHITE_MAN_ON_SQUARE;
+			}
+			analysis.detected_piece_count++;
+		}
+		else // it's not a piece
+		{
+			analysis.board[square_number - 1] = EMPTY_SQUARE;
+		}
+	}
+}
+
+// Class to record square changes and moves from the detected board states of successive frames.
+class MoveTracker
+{
+private:
+	bool mVerbose;
+	int mFramesForChange;
+	int mPieceCount;
+	int mPreviousBoard[NUMBER_OF_SQUARES];
+	// The candidate starting board, and the number of successive unobscured frames in which it has been detected (see seedBoard).
+	int mSeedBoard[NUMBER_OF_SQUARES];
+	int mSeedFrames;
+	DifferenceLog mSquareDiffLog[NUMBER_OF_SQUARES];
+	// Ring buffer of the square changes in the last MOVE_WINDOW_FRAMES frames (at most one change per square per frame).
+	SquareChange mRecentChanges[NUMBER_OF_SQUARES * (MOVE_WINDOW_FRAMES + 1)];
+	int mOldestChange;
+	int mNumberOfRecentChanges;
+	// The last frame in which each move (from, to, piece) was recorded.
+	int mLastMoveFrame[NUMBER_OF_SQUARES][NUMBER_OF_SQUARES][BLACK_KING_ON_SQUARE + 1];
+	vector<Move> mMoves;
+	SquareChange& getRecentChange(int age);
+public:
+	MoveTracker(bool verbose = true, int frames_for_change = CHANGE_PERSISTENCE_FRAMES);
+	void setBoard(const int board[NUMBER_OF_SQUARES], int piece_count);
+	bool seedBoard(FrameAnalysis& analysis);
+	void getBoard(int board[NUMBER_OF_SQUARES]);
+	bool isFrameConsidered(int object_pixels);
+	void update(FrameAnalysis& analysis);
+	vector<Move> getMoves();
+};
+
+MoveTracker::MoveTracker(bool verbose, int frames_for_change)
+{
+	mVerbose = verbose;
+	mFramesForChange = frames_for_change;
+	// Start from the initial position.
+	mPieceCount = 24;
+	for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+	{
+		if (square_number <= 12)
+			mPreviousBoard[square_number - 1] = WHITE_MAN_ON_SQUARE;
+		else if (square_number <= 20)
+			mPreviousBoard[square_number - 1] = EMPTY_SQUARE;
+		else mPreviousBoard[square_number - 1] = BLACK_MAN_ON_SQUARE;
+	}
+	mSeedFrames = 0;
+	mOldestChange = 0;
+	mNumberOfRecentChanges = 0;
+	for (int from = 0; from < NUMBER_OF_SQUARES; from++)
+		for (int to = 0; to < NUMBER_OF_SQUARES; to++)
+			for (int piece = 0; piece <= BLACK_KING_ON_SQUARE; piece++)
+				mLastMoveFrame[from][to][piece] = NO_FRAME;
+}
+
+// Get a recent square change (age 0 is the most recent).
+SquareChange& MoveTracker::getRecentChange(int age)
+{
+	const int capacity = sizeof(mRecentChanges) / sizeof(mRecentChanges[0]);
+	return mRecentChanges[(mOldestChange + mNumberOfRecentChanges - 1 - age) % capacity];
+}
+
+// Set the tracked board state (e.g. when starting part way through a video).
+void MoveTracker::setBoard(const int board[NUMBER_OF_SQUARES], int piece_count)
+{
+	for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
+	{
+		mPreviousBoard[square_number] = board[square_number];
+	}
+	mPieceCount = piece_count;
+}
+
+// Offer the board detected in a frame as the starting state (when starting part way through a video).  Frames which are obscured
+// (judged as in isFrameConsidered, but against the frame's own piece count) are ignored, and the board is only set once it has been
+// detected unchanged in SEED_CONFIRMATION_FRAMES successive unobscured frames.  Returns whether the board has been set.
+bool MoveTracker::seedBoard(FrameAnalysis& analysis)
+{
+	if (analysis.object_pixels >= analysis.detected_piece_count * PIXELS_IN_SQUARE)
+		return false;
+	bool same_board = (mSeedFrames > 0);
+	for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
+	{
+		if (mSeedBoard[square_number] != analysis.board[square_number])
+			same_board = false;
+	}
+	if (!same_board)
+	{
+		for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
+		{
+			mSeedBoard[square_number] = analysis.board[square_number];
+		}
+		mSeedFrames = 0;
+	}
+	mSeedFrames++;
+	if (mSeedFrames < SEED_CONFIRMATION_FRAMES)
+		return false;
+	setBoard(mSeedBoard, analysis.detected_piece_count);
+	return true;
+}
+
+void MoveTracker::getBoard(int board[NUMBER_OF_SQUARES])
+{
+	for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
+	{
+		board[square_number] = mPreviousBoard[square_number];
+	}
+}
+
+// Only consider frames with certain number of object pixels (i.e. where the board is not obscured).
+bool MoveTracker::isFrameConsidered(int object_pixels)
+{
+	return object_pixels < (mPieceCount * PIXELS_IN_SQUARE);
+}
+
+// Update the tracked board with the board state detected in a frame, recording any square changes and moves.
+void MoveTracker::update(FrameAnalysis& analysis)
+{
+	int frame = analysis.frame_number;
+	int* current_board = analysis.board;
+	if (mVerbose)
+		cout << "Frame " << frame << endl;
+
+	// Only consider changes in last 10 frames.
+	const int capacity = sizeof(mRecentChanges) / sizeof(mRecentChanges[0]);
+	while ((mNumberOfRecentChanges > 0) && (frame - mRecentChanges[mOldestChange].frame_number > MOVE_WINDOW_FRAMES))
+	{
+		mOldestChange = (mOldestChange + 1) % capacity;
+		mNumberOfRecentChanges--;
+	}
+
+	// Record differences between frames.
+	int diffs[NUMBER_OF_SQUARES];
+	int number_of_diffs = 0;
+	for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
+	{
+		// Difference must go from piece to empty or vice versa.
+		if (mPreviousBoard[square_number] != current_board[square_number]
+			&& ((mPreviousBoard[square_number] == EMPTY_SQUARE && !(current_board[square_number] == EMPTY_SQUARE))
+				|| (!(mPreviousBoard[square_number] == EMPTY_SQUARE) && current_board[square_number] == EMPTY_SQUARE)))
+		{
+			diffs[number_of_diffs++] = square_number;
+			//cout << "Difference at " << square_number + 1 << "\t Was: " << mPreviousBoard[square_number] << "\tNow: " << current_board[square_number] << endl;
+		}
+	}
+
+	// Check if difference persists across previous frames.
+	for (int i = 0; i < number_of_diffs; i++)
+	{
+		int square_number = diffs[i];
+		DifferenceLog& log = mSquareDiffLog[square_number];
+		if ((log.frames != 0) && (frame - log.first_frame_number <= 10))
+		{
+			log.frames |= 1 << (frame - log.first_frame_number);
+		}
+		else
+		{
+			// Start a new window from this frame.
+			log.first_frame_number = frame;
+			log.frames = 1;
+		}
+		// Update square if difference persists across 5 of the previous 10 frames (or 2 if only settled frames are classified).
+		if (PopCount(log.frames) == mFramesForChange)
+		{
+			if (mVerbose)
+				cout << "\tUpdate square " << square_number + 1 << " from " << mPreviousBoard[square_number] << " to " << current_board[square_number] << endl;
+			mRecentChanges[(mOldestChange + mNumberOfRecentChanges) % capacity] = SquareChange(square_number, frame, mPreviousBoard[square_number], current_board[square_number]);
+			mNumberOfRecentChanges++;
+			mPreviousBoard[square_number] = current_board[square_number];
+			log.frames = 0;
+		}
+	}
+
+	// Identify moves from updated squares.
+	for (int i = 0; i < mNumberOfRecentChanges; i++)
+	{
+		SquareChange& square_change1 = getRecentChange(i);
+		for (int j = 0; j < mNumberOfRecentChanges; j++)
+		{
+			SquareChange& square_change2 = getRecentChange(j);
+			// Check for moves.
+			if ((abs(square_change1.frame_number - square_change2.frame_number) <= MOVE_WINDOW_FRAMES)
+				&& (square_change1.before != EMPTY_SQUARE) && (square_change2.before == EMPTY_SQUARE)
+				//&& (square_change1.before == square_change2.after) 
+				&& square_change1.square_number != square_change2.square_number)
+			{
+				int from = square_change1.square_number + 1;
+				int to = square_change2.square_number + 1;
+
+				// Check if move already recorded.
+				int& last_move_frame = mLastMoveFrame[from - 1][to - 1][square_change1.before];
+				bool moveRecorded = (last_move_frame != NO_FRAME) && (frame - last_move_frame <= MOVE_WINDOW_FRAMES);
+				// Record move.
+				if (!moveRecorded)
+				{
+					if (mVerbose)
+						cout << "\t Move from " << from << " to " << to << endl;
+					mMoves.push_back(Move(frame, from, to, square_change1.before));
+					last_move_frame = frame;
+				}
+			}
+		}
+	}				
+
+	//// Check for any valid moves.
+	//bool moveMade = false;
+	//for (int i = 0; !moveMade && i < mSquareChanges.size(); i++)
+	//{
+	//	SquareChange* square_change1 = mSquareChanges[i];
+	//	for (int j = 0; !moveMade && j < mSquareChanges.size(); j++)
+	//	{
+	//		SquareChange* square_change2 = mSquareChanges[j];
+	//		int from = square_change1->square_number + 1;
+	//		int to = square_change2->square_number + 1;
+	//		if (i != j && !moveMade && isValidMove(mPreviousBoard, current_board, from, to))
+	//		{
+	//			cout << "Frame " << frame << endl;
+	//			cout << "\tSwap from " << from << " to " << to << endl;
+	//			executeMove(mPreviousBoard, current_board, from, to);
+	//			moveMade = true;
+	//		}
+	//	}
+	//}
+
+	mPieceCount = analysis.detected_piece_count;
+}
+
+vector<Move> MoveTracker::getMoves()
+{
+	return mMoves;
+}
+
+// Bounded lock-free queue for passing items from one producer thread to one consumer thread.  A thread which finds the queue full
+// (or empty) retries briefly and then blocks until the other thread pops (or pushes), so idle pipeline stages do not hold their cores.
+template <class T, int CAPACITY>
+class SingleProducerSingleConsumerQueue
+{
+private:
+	// One slot is always left empty to distinguish a full queue from an empty one.
+	T mItems[CAPACITY + 1];
+	std::atomic<int> mHead;
+	std::atomic<int> mTail;
+	// Threads blocked on the queue (only touched once a thread has given up retrying, so the fast path stays lock-free).
+	std::atomic<int> mWaiters;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool isFull()
+	{
+		return (mTail.load(std::memory_order_acquire) + 1) % (CAPACITY + 1) == mHead.load(std::memory_order_acquire);
+	}
+	bool isEmpty()
+	{
+		return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+	}
+	// Wake any blocked thread after a push or pop.  The fence orders the update of the head or tail before the check of the
+	// waiters (matching the one in waitUntil), so a thread cannot block after missing the update.
+	void notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (mWaiters.load(std::memory_order_relaxed) > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+			}
+			mCondition.notify_all();
+		}
+	}
+	template <class Predicate>
+	void waitUntil(Predicate ready)
+	{
+		mWaiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, ready);
+		}
+		mWaiters.fetch_sub(1);
+	}
+public:
+	SingleProducerSingleConsumerQueue() : mHead(0), mTail(0), mWaiters(0) {}
+	bool tryPush(const T& item)
+	{
+		int tail = mTail.load(std::memory_order_relaxed);
+		int next_tail = (tail + 1) % (CAPACITY + 1);
+		if (next_tail == mHead.load(std::memory_order_acquire))
+			return false;
+		mItems[tail] = item;
+		mTail.store(next_tail, std::memory_order_release);
+		return true;
+	}
+	bool tryPop(T& item)
+	{
+		int head = mHead.load(std::memory_order_relaxed);
+		if (head == mTail.load(std::memory_order_acquire))
+			return false;
+		item = mItems[head];
+		mHead.store((head + 1) % (CAPACITY + 1), std::memory_order_release);
+		return true;
+	}
+	void push(const T& item)
+	{
+		for (int attempt = 0; !tryPush(item); attempt++)
+		{
+			if (attempt < QUEUE_SPIN_ATTEMPTS)
+				std::this_thread::yield();
+			else waitUntil([this] { return !isFull(); });
+		}
+		notify();
+	}
+	T pop()
+	{
+		T item;
+		for (int attempt = 0; !tryPop(item); attempt++)
+		{
+			if (attempt < QUEUE_SPIN_ATTEMPTS)
+				std::this_thread::yield();
+			else waitUntil([this] { return !isEmpty(); });
+		}
+		notify();
+		return item;
+	}
+};
+
+void MyApplication()
+{
+	string video_filename("Media/DraughtsGame1.avi");
+	VideoCapture video;
+	video.open(video_filename);
+
+	string black_pieces_filename("Media/DraughtsGame1BlackPieces.jpg");
+	Mat black_pieces_image = imread(black_pieces_filename, -1);
+	string white_pieces_filename("Media/DraughtsGame1WhitePieces.jpg");
+	Mat white_pieces_image = imread(white_pieces_filename, -1);
+	string black_squares_filename("Media/DraughtsGame1BlackSquares.jpg");
+	Mat black_squares_image = imread(black_squares_filename, -1);
+	string white_squares_filename("Media/DraughtsGame1WhiteSquares.jpg");
+	Mat white_squares_image = imread(white_squares_filename, -1);
+	string background_filename("Media/DraughtsGame1EmptyBoard.JPG");
+	Mat static_background_image = imread(background_filename, -1);
+	if ((!video.isOpened()) || (black_pieces_image.empty()) || (white_pieces_image.empty()) || (black_squares_image.empty()) || (white_squares_image.empty())  || (static_background_image.empty()))
+	{
+		// Error attempting to load something.
+		if (!video.isOpened())
+			cout << "Cannot open video file: " << video_filename << endl;
+		if (black_pieces_image.empty())
+			cout << "Cannot open image file: " << black_pieces_filename << endl;
+		if (white_pieces_image.empty())
+			cout << "Cannot open image file: " << white_pieces_filename << endl;
+		if (black_squares_image.empty())
+			cout << "Cannot open image file: " << black_squares_filename << endl;
+		if (white_squares_image.empty())
+			cout << "Cannot open image file: " << white_squares_filename << endl;
+		if (static_background_image.empty())
+			cout << "Cannot open image file: " << background_filename << endl;
+	}
+	else
+	{	
+		/* RECOMMENDED TO COMMENT OUT PARTS AND RUN EACH INDIVIDUALLY*/
+		// Classify the pixels.
+		part1(black_pieces_image, white_pieces_image, black_squares_image, white_squares_image);
+
+		// Compute confusion matrix for pieces in squares (part 2) and the extended confusion matrix distinguishing between
+		// normal pieces and kings (part 5), from a single pass over the static images.
+		int confusion_matrix[3][3] = {{0, 0, 0},
+									   {0, 0, 0}, 
+									   {0, 0, 0} };
+		int extended_confusion_matrix[5][5] = {{0, 0, 0, 0, 0},
+									            {0, 0, 0, 0, 0},
+									            {0, 0, 0, 0, 0} };
+		ConfusionMatrixClassifier<3> piece_classifier(part2, confusion_matrix);
+		ConfusionMatrixClassifier<5> king_classifier(part5, extended_confusion_matrix);
+		StillImageEvaluator still_image_evaluator(static_background_image);
+		still_image_evaluator.registerClassifier(&piece_classifier);
+		still_image_evaluator.registerClassifier(&king_classifier);
+		still_image_evaluator.evaluate();
+		cout << "Confusion Matrix:\n"
+			<< "\tGT_NP\tGT_WP\tGT_BP\n"
+			<< "D_NP\t" << confusion_matrix[0][0] << "\t" << confusion_matrix[0][1] << "\t" << confusion_matrix[0][2] << "\n" 
+			<< "D_WP\t" << confusion_matrix[1][0] << "\t" << confusion_matrix[1][1] << "\t" << confusion_matrix[1][2] << "\n" 
+			<< "D_BP\t" << confusion_matrix[2][0] << "\t" << confusion_matrix[2][1] << "\t" << confusion_matrix[2][2] << endl;
+
+		// Record moves in video.
+		part3(static_background_image, video);
+
+		// Identify four corners of the chessboard.
+		part4(static_background_image);
+
+		// Distinguish between normal pieces and kings.
+		cout << "Confusion Matrix:\n"
+			<< "\tGT_NP\tGT_WM\tGT_WK\tGT_BM\tGT_BK\n"
+			<< "D_NP\t" << extended_confusion_matrix[0][0] << "\t" << extended_confusion_matrix[0][1] << "\t" << extended_confusion_matrix[0][2] << "\t" << extended_confusion_matrix[0][3] << "\t" << extended_confusion_matrix[0][4] << "\n"
+			<< "D_WM\t" << extended_confusion_matrix[1][0] << "\t" << extended_confusion_matrix[1][1] << "\t" << extended_confusion_matrix[1][2] << "\t" << extended_confusion_matrix[1][3] << "\t" << extended_confusion_matrix[1][4] << "\n"
+			<< "D_WK\t" << extended_confusion_matrix[1][0] << "\t" << extended_confusion_matrix[2][1] << "\t" << extended_confusion_matrix[2][2] << "\t" << extended_confusion_matrix[2][3] << "\t" << extended_confusion_matrix[2][4] << "\n"
+			<< "D_BM\t" << extended_confusion_matrix[1][0] << "\t" << extended_confusion_matrix[3][1] << "\t" << extended_confusion_matrix[3][2] << "\t" << extended_confusion_matrix[3][3] << "\t" << extended_confusion_matrix[3][4] << "\n"
+			<< "D_BK\t" << extended_confusion_matrix[2][0] << "\t" << extended_confusion_matrix[4][1] << "\t" << extended_confusion_matrix[4][2] << "\t" << extended_confusion_matrix[4][3] << "\t" << extended_confusion_matrix[4][4] << endl;
+	}
+}
+
+// Record the moves in a video without opening any windows (for batch processing on machines without a display).
+int MyHeadlessApplication(string video_filename, string background_filename, TrackingOptions options)
+{
+	VideoCapture video;
+	video.open(video_filename);
+	Mat static_background_image = imread(background_filename, -1);
+	if ((!video.isOpened()) || (static_background_image.empty()))
+	{
+		// Error attempting to load something.
+		if (!video.isOpened())
+			cout << "Cannot open video file: " << video_filename << endl;
+		if (static_background_image.empty())
+			cout << "Cannot open image file: " << background_filename << endl;
+		return -1;
+	}
+
+	// Record moves in video and report throughput.
+	double start_time = static_cast<double>(getTickCount());
+	options.display_video = false;
+	int number_of_frames = 0;
+	if (options.segments > 1)
+	{
+		video.release();
+		number_of_frames = trackMovesInSegments(video_filename, static_background_image, options);
+	}
+	else
+	{
+		number_of_frames = part3(static_background_image, video, options);
+	}
+	double wall_time = (static_cast<double>(getTickCount()) - start_time) / getTickFrequency();
+	cout << "Processed " << number_of_frames << " frames in " << wall_time << " seconds ("
+		<< ((wall_time > 0.0) ? number_of_frames / wall_time : 0.0) << " frames/second)." << endl;
+	return 0;
+}
+
+// Compare the per-frame cost of the original perspective transformation with the cached remap tables.
+int BenchmarkPerspectiveTransformation(string image_filename, int iterations)
+{
+	Mat board_image = imread(image_filename, -1);
+	if (board_image.empty())
+	{
+		cout << "Cannot open image file: " << image_filename << endl;
+		return -1;
+	}
+
+	// Original approach:  rebuild the homography and warp every pixel on each call.
+	Point2f destination[4] = { Point2f(0, 0), Point2f(0, BOARD_DIMENSIONS_IN_PIXELS), Point2f(BOARD_DIMENSIONS_IN_PIXELS, 0), Point2f(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS) };
+	Mat original_result;
+	double start_time = static_cast<double>(getTickCount());
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		original_result = Mat::zeros(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS, board_image.type());
+		Mat perspective_matrix = getPerspectiveTransform(BOARD_CORNERS, destination);
+		warpPerspective(board_image, original_result, perspective_matrix, original_result.size());
+	}
+	double original_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency() / iterations;
+
+	// Cached remap tables and a reused result buffer.
+	BoardWarp board_warp;
+	Mat cached_result;
+	start_time = static_cast<double>(getTickCount());
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		board_warp.warp(board_image, cached_result);
+	}
+	double cached_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency() / iterations;
+
+	cout << "Perspective transformation (" << iterations << " iterations of " << image_filename << "):\n"
+		<< "\tgetPerspectiveTransform + warpPerspective: " << original_time << "ms per frame\n"
+		<< "\tCached remap tables: " << cached_time << "ms per frame\n"
+		<< "\tSaving: " << original_time - cached_time << "ms per frame\n"
+		<< "\tMaximum pixel difference: " << norm(original_result, cached_result, NORM_INF) << endl;
+	return 0;
+}
+
+#if defined(CHECK_FRAME_ALLOCATIONS)
+// Heap allocations made through operator new (and new[]) while counting is enabled (see CheckFrameAllocations).  The replacement
+// operators are only compiled into builds which define CHECK_FRAME_ALLOCATIONS, and only see allocations made in this program (and,
+// where symbols are interposed as on Linux, in the OpenCV libraries, but not in the OpenCV DLLs on Windows).
+static std::atomic<bool> gCountHeapAllocations(false);
+static std::atomic<long long> gHeapAllocations(0);
+
+void* operator new(size_t size)
+{
+	if (gCountHeapAllocations.load(std::memory_order_relaxed))
+		gHeapAllocations++;
+	void* memory;
+	while ((memory = malloc((size > 0) ? size : 1)) == NULL)
+	{
+		// As the standard operator new does, give the new handler a chance to free some memory.
+		std::new_handler handler = std::get_new_handler();
+		if (handler == NULL)
+			throw std::bad_alloc();
+		handler();
+	}
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+// Mat allocator which counts the image allocations made (passing them on to the standard allocator).  Image buffers are allocated
+// with fastMalloc rather than operator new, so they are counted here.
+class CountingMatAllocator : public MatAllocator
+{
+private:
+	MatAllocator* mAllocator;
+public:
+	mutable std::atomic<int> mAllocations;
+	CountingMatAllocator() : mAllocator(Mat::getStdAllocator()), mAllocations(0) {}
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usage_flags) const override
+	{
+		mAllocations++;
+		return mAllocator->allocate(dims, sizes, type, data, step, flags, usage_flags);
+	}
+	bool allocate(UMatData* data, AccessFlag access_flags, UMatUsageFlags usage_flags) const override
+	{
+		return mAllocator->allocate(data, access_flags, usage_flags);
+	}
+	void deallocate(UMatData* data) const override
+	{
+		mAllocator->deallocate(data);
+	}
+};
+
+// Count the heap and image allocations made by the given work while counting is enabled.
+void countAllocations(std::function<void()> work, long long& heap_allocations, long long& image_allocations)
+{
+	CountingMatAllocator allocator;
+	MatAllocator* default_allocator = Mat::getDefaultAllocator();
+	Mat::setDefaultAllocator(&allocator);
+	gHeapAllocations = 0;
+	gCountHeapAllocations = true;
+	work();
+	gCountHeapAllocations = false;
+	Mat::setDefaultAllocator(default_allocator);
+	heap_allocations = gHeapAllocations;
+	image_allocations = allocator.mAllocations;
+}
+
+// Check that, once the workspace has been set up by the first frame, analysing frames makes no heap allocations (other than those
+// made inside OpenCV), counting both allocations through operator new (e.g. vectors and strings) and image buffers.  remap and
+// cvtColor allocate temporary buffers and parallel jobs on every call, so the allocations which those calls make on their own (with
+// the same images) are measured first and allowed for.  The static board images are used as the frames (as the video is not always
+// available).  Returns 1 if there were any other allocations.
+int CheckFrameAllocations(string background_filename)
+{
+	Mat empty_board_image = imread(background_filename, -1);
+	if (empty_board_image.empty())
+	{
+		cout << "Cannot open image file: " << background_filename << endl;
+		return -1;
+	}
+	vector<Mat> frames;
+	for (int image_index = 0; image_index < NUMBER_OF_STATIC_IMAGES; image_index++)
+	{
+		string filename = string("Media/") + GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][0];
+		Mat image = imread(filename, -1);
+		if (!image.empty())
+			frames.push_back(image);
+	}
+	if (frames.empty())
+	{
+		cout << "Cannot open the static board images." << endl;
+		return -1;
+	}
+
+	long long total_allocations = 0;
+	for (int sparse_squares = 0; sparse_squares <= 1; sparse_squares++)
+	{
+		BoardStateDetector detector(empty_board_image, sparse_squares == 1);
+		FrameAnalysis analysis;
+		FrameWorkspace workspace;
+		analysis.frame = frames[0];
+		detector.findMovingPoints(analysis, workspace);
+		detector.classifySquares(analysis, workspace);
+
+		// The OpenCV calls made for each frame (the warp in findMovingPoints, and the HSV conversion in classifySquares) on their own.
+		BoardWarp board_warp;
+		Mat board_pt, board_hsv;
+		auto opencv_calls = [&]()
+		{
+			for (int frame_index = 0; frame_index < (int)frames.size(); frame_index++)
+			{
+				if (sparse_squares)
+					board_warp.warpSquares(frames[frame_index], board_pt);
+				else board_warp.warp(frames[frame_index], board_pt);
+				cvtColor(board_pt, board_hsv, COLOR_BGR2HSV);
+			}
+		};
+		opencv_calls();
+		long long opencv_heap_allocations = 0, opencv_image_allocations = 0;
+		countAllocations(opencv_calls, opencv_heap_allocations, opencv_image_allocations);
+
+		long long heap_allocations = 0, image_allocations = 0;
+		countAllocations([&]()
+		{
+			for (int frame_index = 0; frame_index < (int)frames.size(); frame_index++)
+			{
+				analysis.frame_number = frame_index;
+				analysis.frame = frames[frame_index];
+				detector.findMovingPoints(analysis, workspace);
+				detector.classifySquares(analysis, workspace);
+			}
+		}, heap_allocations, image_allocations);
+
+		long long other_heap_allocations = max(heap_allocations - opencv_heap_allocations, 0LL);
+		long long other_image_allocations = max(image_allocations - opencv_image_allocations, 0LL);
+		cout << (sparse_squares ? "Dark squares only: " : "Whole board: ") << heap_allocations << " heap allocations and " << image_allocations
+			<< " image allocations in " << frames.size() << " frames after the first, of which " << opencv_heap_allocations << " and "
+			<< opencv_image_allocations << " are made inside remap and cvtColor." << endl;
+		total_allocations += other_heap_allocations + other_image_allocations;
+	}
+	return (total_allocations == 0) ? 0 : 1;
+}
+#else
+// The allocation check needs the global allocation operators to be replaced, which is only done in builds which define
+// CHECK_FRAME_ALLOCATIONS.
+int CheckFrameAllocations(string background_filename)
+{
+	cout << "The allocation check is only available in builds which define CHECK_FRAME_ALLOCATIONS." << endl;
+	return -1;
+}
+#endif
+
+// Check that DifferenceThreshold gives exactly the same results as absdiff, cvtColor and threshold, and compare their speed.
+int BenchmarkDifferenceThreshold(string image_filename, string background_filename, int iterations)
+{
+	Mat board_image = imread(image_filename, -1);
+	Mat empty_board_image = imread(background_filename, -1);
+	if (board_image.empty() || empty_board_image.empty())
+	{
+		cout << "Cannot open image files: " << image_filename << ", " << background_filename << endl;
+		return -1;
+	}
+	Mat current_board_pt = perspectiveTransformation(board_image);
+	Mat empty_board_pt = perspectiveTransformation(empty_board_image);
+
+	// Check parity on the board images, and on random images (of awkward widths) at a range of thresholds.
+	int mismatches = 0;
+	RNG rng(12345);
+	for (int test = 0; test < 20; test++)
+	{
+		Mat image1 = current_board_pt, image2 = empty_board_pt;
+		int threshold_value = 30;
+		if (test > 0)
+		{
+			Size size(1 + rng.uniform(0, 100), 1 + rng.uniform(0, 10));
+			image1.create(size, CV_8UC3);
+			image2.create(size, CV_8UC3);
+			rng.fill(image1, RNG::UNIFORM, 0, 256);
+			rng.fill(image2, RNG::UNIFORM, 0, 256);
+			threshold_value = rng.uniform(0, 256);
+		}
+		Mat difference, expected_result, result;
+		absdiff(image1, image2, difference);
+		cvtColor(difference, expected_result, COLOR_BGR2GRAY);
+		threshold(expected_result, expected_result, threshold_value, 255, THRESH_BINARY);
+		DifferenceThreshold(image1, image2, result, threshold_value);
+		mismatches += countNonZero(expected_result != result);
+	}
+
+	// Original approach:  three passes, each allocating a new image.
+	double start_time = static_cast<double>(getTickCount());
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		Mat difference;
+		absdiff(current_board_pt, empty_board_pt, difference);
+		Mat moving_points;
+		cvtColor(difference, moving_points, COLOR_BGR2GRAY);
+		threshold(moving_points, moving_points, 30, 255, THRESH_BINARY);
+	}
+	double original_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency() / iterations;
+
+	// Fused single pass into a reused result.
+	Mat moving_points;
+	start_time = static_cast<double>(getTickCount());
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		DifferenceThreshold(current_board_pt, empty_board_pt, moving_points, 30);
+	}
+	double fused_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency() / iterations;
+
+	cout << "Difference and threshold (" << iterations << " iterations of " << image_filename << "):\n"
+		<< "\tabsdiff + cvtColor + threshold: " << original_time << "ms per frame\n"
+		<< "\tDifferenceThreshold: " << fused_time << "ms per frame\n"
+		<< "\tSaving: " << original_time - fused_time << "ms per frame\n"
+		<< "\tMismatched pixels: " << mismatches << endl;
+	return (mismatches == 0) ? 0 : 1;
+}
+
+// Evaluate the classification of the squares in the static images (as in part2 and part5) for every combination of the given
+// parameter values, printing the accuracy and cost of each.  The warped boards and their differences from the empty board are
+// computed once for each image, and the combinations are then evaluated in parallel from them (and timed one at a time afterwards,
+// so that the times are not distorted by the other combinations running at once).  The pixel classification of part1 is then
+// evaluated for each of the given background probability thresholds (see SweepPixelProbabilityThresholds), and the move tracking of
+// part3 for each of the given numbers of frames in which a change must be seen (see SweepChangePersistence).
+int SweepStillImageParameters(string background_filename, vector<double> difference_thresholds, vector<double> occupancy_thresholds,
+	vector<double> king_circularity_thresholds, vector<double> hue_bins, vector<double> probability_thresholds, string video_filename,
+	vector<double> change_persistence_frames)
+{
+	Mat empty_board_image = imread(background_filename, -1);
+	if (empty_board_image.empty())
+	{
+		cout << "Cannot open image file: " << background_filename << endl;
+		return -1;
+	}
+	StillImageEvaluator evaluator(empty_board_image);
+
+	// Load the warped boards and their differences from the empty board.
+	vector<Mat> boards(NUMBER_OF_STATIC_IMAGES);
+	vector<Mat> differences(NUMBER_OF_STATIC_IMAGES);
+	double start_time = static_cast<double>(getTickCount());
+	parallel_for_(Range(0, NUMBER_OF_STATIC_IMAGES), [&](const Range& images)
+	{
+		for (int image_index = images.start; image_index < images.end; image_index++)
+		{
+			evaluator.loadDifference(image_index, boards[image_index], differences[image_index]);
+		}
+	});
+	double load_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency();
+
+	vector<StillImageParameters> combinations;
+	for (double difference_threshold : difference_thresholds)
+		for (double occupancy_threshold : occupancy_thresholds)
+			for (double king_circularity_threshold : king_circularity_thresholds)
+				for (double bins : hue_bins)
+				{
+					StillImageParameters parameters;
+					parameters.difference_threshold = cvRound(difference_threshold);
+					parameters.occupancy_threshold = (float)occupancy_threshold;
+					parameters.king_circularity_threshold = king_circularity_threshold;
+					parameters.hue_bins = max(1, cvRound(bins));
+					combinations.push_back(parameters);
+				}
+
+	// Classify all of the images with one combination of parameters.
+	auto classify_images = [&](StillImageParameters& parameters, int confusion_matrix[3][3], int extended_confusion_matrix[5][5])
+	{
+		StillImage still;
+		Mat moving_points;
+		still.parameters = parameters;
+		for (int image_index = 0; image_index < NUMBER_OF_STATIC_IMAGES; image_index++)
+		{
+			still.image_index = image_index;
+			still.board_pt = boards[image_index];
+			threshold(differences[image_index], moving_points, still.parameters.difference_threshold, 255, THRESH_BINARY);
+			evaluator.findMovingPoints(moving_points, still);
+			part2(still, confusion_matrix);
+			part5(still, extended_confusion_matrix);
+		}
+	};
+
+	// Evaluate the combinations in parallel, each over all of the images.
+	vector<double> piece_accuracy(combinations.size());
+	vector<double> king_accuracy(combinations.size());
+	start_time = static_cast<double>(getTickCount());
+	parallel_for_(Range(0, (int)combinations.size()), [&](const Range& range)
+	{
+		for (int combination = range.start; combination < range.end; combination++)
+		{
+			int confusion_matrix[3][3] = { { 0 } };
+			int extended_confusion_matrix[5][5] = { { 0 } };
+			classify_images(combinations[combination], confusion_matrix, extended_confusion_matrix);
+			int correct = 0, total = 0;
+			for (int detected = 0; detected < 3; detected++)
+				for (int actual = 0; actual < 3; actual++)
+				{
+					correct += (detected == actual) ? confusion_matrix[detected][actual] : 0;
+					total += confusion_matrix[detected][actual];
+				}
+			piece_accuracy[combination] = (total > 0) ? correct / (double)total : 0.0;
+			correct = 0;
+			total = 0;
+			for (int detected = 0; detected < 5; detected++)
+				for (int actual = 0; actual < 5; actual++)
+				{
+					correct += (detected == actual) ? extended_confusion_matrix[detected][actual] : 0;
+					total += extended_confusion_matrix[detected][actual];
+				}
+			king_accuracy[combination] = (total > 0) ? correct / (double)total : 0.0;
+		}
+	});
+	double sweep_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency();
+
+	// Time each combination on its own.
+	vector<double> time_per_image(combinations.size());
+	for (size_t combination = 0; combination < combinations.size(); combination++)
+	{
+		int confusion_matrix[3][3] = { { 0 } };
+		int extended_confusion_matrix[5][5] = { { 0 } };
+		double combination_start_time = static_cast<double>(getTickCount());
+		classify_images(combinations[combination], confusion_matrix, extended_confusion_matrix);
+		time_per_image[combination] = (static_cast<double>(getTickCount()) - combination_start_time) * 1000.0 / getTickFrequency() / NUMBER_OF_STATIC_IMAGES;
+	}
+
+	cout << "Loaded and differenced " << NUMBER_OF_STATIC_IMAGES << " images in " << load_time << "ms, then evaluated "
+		<< combinations.size() << " combinations in " << sweep_time << "ms.\n"
+		<< "Threshold\tOccupancy\tCircularity\tHue bins\tPiece accuracy\tKing accuracy\tms per image\n";
+	for (size_t combination = 0; combination < combinations.size(); combination++)
+	{
+		StillImageParameters& parameters = combinations[combination];
+		cout << parameters.difference_threshold << "\t\t" << parameters.occupancy_threshold << "\t\t" << parameters.king_circularity_threshold
+			<< "\t\t" << parameters.hue_bins << "\t\t" << piece_accuracy[combination] << "\t\t" << king_accuracy[combination]
+			<< "\t\t" << time_per_image[combination] << "\n";
+	}
+	cout.flush();
+	int result = SweepPixelProbabilityThresholds(probability_thresholds);
+	if (result != 0)
+		return result;
+	return SweepChangePersistence(video_filename, empty_board_image, change_persistence_frames);
+}
+
+// Evaluate the move tracking of part3 (without the motion gate or deduplication) for each of the given numbers of frames, out of
+// the last MOVE_WINDOW_FRAMES, in which a square change must be seen (CHANGE_PERSISTENCE_FRAMES by default), printing the moves
+// detected and missed for each.  Every frame of the video is analysed and classified once, and the analyses are then tracked for
+// each value (as the pipeline does, the tracker only considers the frames that trackMoves would have classified).
+int SweepChangePersistence(string video_filename, Mat empty_board_image, vector<double> change_persistence_frames)
+{
+	VideoCapture video(video_filename);
+	if (!video.isOpened())
+	{
+		cout << "Cannot open video file: " << video_filename << endl;
+		return -1;
+	}
+	BoardStateDetector detector(empty_board_image, false);
+	FrameAnalysis analysis;
+	FrameWorkspace workspace;
+	vector<FrameAnalysis> analyses;
+	video.set(cv::CAP_PROP_POS_FRAMES, 1);
+	video >> analysis.frame;
+	for (analysis.frame_number = 0; !analysis.frame.empty(); analysis.frame_number++)
+	{
+		detector.findMovingPoints(analysis, workspace);
+		detector.classifySquares(analysis, workspace);
+		// Only the detected board is needed to track the moves.
+		FrameAnalysis recorded_analysis = analysis;
+		recorded_analysis.frame = Mat();
+		recorded_analysis.board_pt = Mat();
+		recorded_analysis.moving_points = Mat();
+		analyses.push_back(recorded_analysis);
+		video >> analysis.frame;
+	}
+
+	cout << "Analysed " << analyses.size() << " frames of " << video_filename << ".\n"
+		<< "Persistence\tMoves detected\tMoves missed\tTracking ms\n";
+	for (double persistence : change_persistence_frames)
+	{
+		int frames_for_change = max(1, cvRound(persistence));
+		MoveTracker tracker(false, frames_for_change);
+		double start_time = static_cast<double>(getTickCount());
+		for (FrameAnalysis& frame_analysis : analyses)
+		{
+			if (tracker.isFrameConsidered(frame_analysis.object_pixels))
+				tracker.update(frame_analysis);
+		}
+		double tracking_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency();
+		vector<Move> moves = tracker.getMoves();
+		int missed_moves = 0;
+		for (const Move& actual_move : GROUND_TRUTH_FOR_DRAUGHTSGAME1_VIDEO_MOVES)
+		{
+			bool move_detected = false;
+			for (const Move& detected_move : moves)
+				move_detected = move_detected || isMoveDetected(actual_move, detected_move);
+			missed_moves += move_detected ? 0 : 1;
+		}
+		cout << frames_for_change << " of " << MOVE_WINDOW_FRAMES << "\t\t" << moves.size() << "\t\t" << missed_moves << "\t\t" << tracking_time << "\n";
+	}
+	cout.flush();
+	return 0;
+}
+
+// Load the piece and square colour samples used by part1 (indexed by pixel class).
+bool loadColourSamples(Mat samples[NUMBER_OF_COLOUR_SAMPLES])
+{
+	string sample_filenames[NUMBER_OF_COLOUR_SAMPLES] = { "Media/DraughtsGame1WhitePieces.jpg", "Media/DraughtsGame1BlackPieces.jpg",
+		"Media/DraughtsGame1WhiteSquares.jpg", "Media/DraughtsGame1BlackSquares.jpg" };
+	for (int sample = 0; sample < NUMBER_OF_COLOUR_SAMPLES; sample++)
+	{
+		samples[sample] = imread(sample_filenames[sample], -1);
+		if (samples[sample].empty())
+		{
+			cout << "Cannot open image file: " << sample_filenames[sample] << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Classify the pixels of each of the given images as in part1 and evaluate them against the corresponding ground truth images
+// (colour coded with PIXEL_CLASS_COLOURS), printing the combined confusion matrix and per class metrics.  The images are classified
+// in turn (as the classifier reuses its buffers) and then all of them are evaluated in parallel.
+int EvaluatePixelClassification(vector<string> image_filenames, vector<string> ground_truth_filenames)
+{
+	CV_Assert(image_filenames.size() == ground_truth_filenames.size());
+	Mat samples[NUMBER_OF_COLOUR_SAMPLES];
+	if (!loadColourSamples(samples))
+		return -1;
+	ColourClassifier colour_classifier(samples[WHITE_PIECE_PIXEL], samples[BLACK_PIECE_PIXEL], samples[WHITE_SQUARE_PIXEL], samples[BLACK_SQUARE_PIXEL]);
+	vector<Mat> detected_labels(image_filenames.size());
+	vector<Mat> ground_truth_labels(image_filenames.size());
+	for (size_t frame = 0; frame < image_filenames.size(); frame++)
+	{
+		Mat image = imread(image_filenames[frame], -1);
+		Mat ground_truth_image = imread(ground_truth_filenames[frame], -1);
+		if (image.empty() || ground_truth_image.empty())
+		{
+			cout << "Cannot open image files: " << image_filenames[frame] << ", " << ground_truth_filenames[frame] << endl;
+			return -1;
+		}
+		if (ground_truth_image.channels() == 4)
+			cvtColor(ground_truth_image, ground_truth_image, COLOR_BGRA2BGR);
+		colour_classifier.classify(image, detected_labels[frame]);
+		colourToLabels(ground_truth_image, ground_truth_labels[frame]);
+	}
+	PixelClassMetrics metrics;
+	evaluatePixelLabels(detected_labels, ground_truth_labels, metrics);
+	cout << "Pixel classification of " << image_filenames.size() << " labelled images:" << endl;
+	printPixelClassMetrics(metrics);
+	return 0;
+}
+
+// Evaluate the pixel classification of part1 against its ground truth for each of the given thresholds on the highest stretched
+// back projection (below which pixels are background), printing the pixel accuracy, mean intersection over union and cost of each.
+int SweepPixelProbabilityThresholds(vector<double> probability_thresholds)
+{
+	Mat samples[NUMBER_OF_COLOUR_SAMPLES];
+	if (!loadColourSamples(samples))
+		return -1;
+	string source_filename = "Media/DraughtsGame1Move0.JPG";
+	string ground_truth_filename = "Media/DraughtsGame1Move0GroundTruth.png";
+	Mat source_image = imread(source_filename, -1);
+	Mat ground_truth_image = imread(ground_truth_filename, -1);
+	if (source_image.empty() || ground_truth_image.empty())
+	{
+		cout << "Cannot open image files: " << source_filename << ", " << ground_truth_filename << endl;
+		return -1;
+	}
+	cvtColor(ground_truth_image, ground_truth_image, COLOR_BGRA2BGR);
+	Mat ground_truth_labels;
+	colourToLabels(ground_truth_image, ground_truth_labels);
+
+	ColourClassifier colour_classifier(samples[WHITE_PIECE_PIXEL], samples[BLACK_PIECE_PIXEL], samples[WHITE_SQUARE_PIXEL], samples[BLACK_SQUARE_PIXEL]);
+	Mat pixel_classes;
+	cout << "Probability\tPixel accuracy\tMean IoU\tms per image\n";
+	for (double probability_threshold : probability_thresholds)
+	{
+		double start_time = static_cast<double>(getTickCount());
+		colour_classifier.classify(source_image, pixel_classes, NULL, cvRound(probability_threshold));
+		double classify_time = (static_cast<double>(getTickCount()) - start_time) * 1000.0 / getTickFrequency();
+		PixelClassMetrics metrics;
+		evaluatePixelLabels(pixel_classes, ground_truth_labels, metrics);
+		double total_intersection_over_union = 0.0;
+		for (int pixel_class = 0; pixel_class < NUMBER_OF_PIXEL_CLASSES; pixel_class++)
+			total_intersection_over_union += metrics.getIntersectionOverUnion(pixel_class);
+		cout << cvRound(probability_threshold) << "\t\t" << 1.0 - metrics.getMisclassifications() / (double)source_image.total()
+			<< "\t\t" << total_intersection_over_union / NUMBER_OF_PIXEL_CLASSES << "\t\t" << classify_time << "\n";
+	}
+	cout.flush();
+	return 0;
+}
+
+void part1(Mat black_pieces_image, Mat white_pieces_image, Mat black_squares_image, Mat white_squares_image)
+{
+	// Load image to classify.
+	string source_filename = "Media/DraughtsGame1Move0.JPG";
+	Mat source_image = imread(source_filename, -1);
+	if (source_image.empty())
+	{
+		cout << "Cannot open image file: " << source_filename << endl;
+	}
+
+	// Show source image.
+	displayImage("Source", source_image);
+
+	/*// Use k-means clustering.
+	Mat data;
+	source_image.convertTo(data, CV_32F);
+	data = data.reshape(1, data.total());
+	Mat labels, centers;
+	kmeans(data, 4, labels, TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 100, 0.5), 3, KMEANS_PP_CENTERS, centers);
+	centers = centers.reshape(3, centers.rows);
+	data = data.reshape(3, data.rows);
+	Vec3f* p = data.ptr<Vec3f>();
+	for (int i = 0; i < data.rows; i++) 
+	{
+		int center_id = labels.at<int>(i);
+		p[i] = centers.at<Vec3f>(center_id);
+	}
+	source_image = data.reshape(3, source_image.rows);
+	source_image.convertTo(source_image, CV_8U);
+	displayImage("k-means", source_image);*/
+
+	/*// Backprojections using hue histograms.
+	int bins = 25;
+	histogramAndBackproject("white pieces", white_pieces_image, source_image, bins);
+	histogramAndBackproject("black pieces", black_pieces_image, source_image, bins);
+	histogramAndBackproject("white squares", white_squares_image, source_image, bins);
+	histogramAndBackproject("black squares", black_squares_image, source_image, bins);*/
+
+	// Backproject piece and square samples onto source (through a lookup table over the quantised colours).
+	ColourClassifier colour_classifier(white_pieces_image, black_pieces_image, white_squares_image, black_squares_image);
+	Mat pixel_classes;
+	Mat probability_images[NUMBER_OF_COLOUR_SAMPLES];
+	colour_classifier.classify(source_image, pixel_classes, probability_images);
+	Mat& white_pieces_probs = probability_images[WHITE_PIECE_PIXEL];
+	Mat& black_pieces_probs = probability_images[BLACK_PIECE_PIXEL];
+	Mat& white_squares_probs = probability_images[WHITE_SQUARE_PIXEL];
+	Mat& black_squares_probs = probability_images[BLACK_SQUARE_PIXEL];
+	Mat pieces_probs = JoinImagesHorizontally(white_pieces_probs, "white pieces", black_pieces_probs, "black pieces", 4, 255);
+	Mat squares_probs = JoinImagesHorizontally(white_squares_probs, "white squares", black_squares_probs, "black squares", 4, 255);
+	Mat backprojections = JoinImagesVertically(pieces_probs, "", squares_probs, "", 4, 255);
+	displayImage("Backprojections", backprojections);
+
+	// Compare probability images to classify image.
+	Mat classification_image(source_image.size(), CV_8UC3);
+	parallel_for_(Range(0, classification_image.rows), [&](const Range& rows)
+	{
+		for (int i = rows.start; i < rows.end; i++)
+		{
+			const uchar* classes = pixel_classes.ptr<uchar>(i);
+			Vec3b* colours = classification_image.ptr<Vec3b>(i);
+			for (int j = 0; j < classification_image.cols; j++)
+			{
+				colours[j] = PIXEL_CLASS_COLOURS[classes[j]];
+			}
+		}
+	});
+	//displayImage("Classification Image", classification_image);
+
+	// Load ground truth image.
+	string ground_truth_filename = "Media/DraughtsGame1Move0GroundTruth.png";
+	Mat ground_truth_image = imread(ground_truth_filename, -1);
+	if (ground_truth_image.empty())
+	{
+		cout << "Cannot open image file: " << ground_truth_filename << endl;
+	}
+	cvtColor(ground_truth_image, ground_truth_image, COLOR_BGRA2BGR);
+
+	// Compare qualitatively with ground truth.
+	Mat difference_image;
+	absdiff(classification_image, ground_truth_image, difference_image);
+	//displayImage("Difference with Ground Truth", difference_image);
+	Mat binary_difference_image;
+	cvtColor(difference_image, binary_difference_image, COLOR_BGR2GRAY);
+	threshold(binary_difference_image, binary_difference_image, 30, 255, THRESH_BINARY);
+	//displayImage("Binary Difference with Ground Truth", binary_difference_image);
+
+	// Display results.
+	Mat classification_images = JoinImagesHorizontally(ground_truth_image, "Ground Truth", classification_image, "Classification", 4, -1);
+	cvtColor(binary_difference_image, binary_difference_image, COLOR_GRAY2BGR);
+	Mat difference_images = JoinImagesHorizontally(difference_image, "Difference with Ground Truth", binary_difference_image, "Binary Difference with Ground Truth", 4, -1);
+	Mat results = JoinImagesVertically(classification_images, "", difference_images, "", 4, 255);
+	displayImage("Classifying the pixels", results);
+
+	// Compare quantitatively with ground truth (as pixel class labels).
+	Mat ground_truth_labels;
+	colourToLabels(ground_truth_image, ground_truth_labels);
+	PixelClassMetrics metrics;
+	evaluatePixelLabels(pixel_classes, ground_truth_labels, metrics);
+	printPixelClassMetrics(metrics);
+	long long misclassifications = metrics.getMisclassifications();
+	long long white_piece_misclassifications = metrics.getMisclassifications(WHITE_PIECE_PIXEL);
+	long long black_piece_misclassifications = metrics.getMisclassifications(BLACK_PIECE_PIXEL);
+	long long white_square_misclassifications = metrics.getMisclassifications(WHITE_SQUARE_PIXEL);
+	long long black_square_misclassifications = metrics.getMisclassifications(BLACK_SQUARE_PIXEL);
+	long long background_misclassifications = metrics.getMisclassifications(BACKGROUND_PIXEL);
+	cout << "Misclassifications\n" 
+		<< "\tWhite pieces: " << white_piece_misclassifications
+		<< "\n\tBlack pieces: " << black_piece_misclassifications
+		<< "\n\tWhite squares: " << white_square_misclassifications
+		<< "\n\tBlack squares: " << black_square_misclassifications 
+		<< "\n\tBackground: " << background_misclassifications
+		<< "\nTotal: " << misclassifications << endl;
+}
+
+// Classify the pieces in the squares of a static image as white or black, updating the confusion matrix.
+void part2(StillImage& still, int confusion_matrix[3][3])
+{
+	// Display results (showing the pieces using the difference image as mask).
+	/*Mat pieces_image = Mat::zeros(still.dilated_points.size(), CV_8UC3);
+	still.board_pt.copyTo(pieces_image, still.dilated_points);
+	Mat display_image = still.dilated_points.clone();
+	cvtColor(display_image, display_image, COLOR_GRAY2BGR);
+	Mat results = JoinImagesHorizontally(display_image, "Difference with Geometric Operations", pieces_image, "Pieces", 4, -1);
+	displayImage("Identifying the squares and pieces", results);*/
+
+	// Identify pieces in squares.
+	float occupancy[NUMBER_OF_SQUARES];
+	getSquareOccupancy(still.dilated_mask, occupancy);
+	Mat board_hsv;
+	bool is_black_piece[NUMBER_OF_SQUARES];
+	float colour_margin[NUMBER_OF_SQUARES];
+	getPieceColours(still.board_pt, still.dilated_points, board_hsv, is_black_piece, colour_margin, still.parameters.hue_bins);
+	int square_number = 1;
+	for (int i = 0; i < 8; i++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			if (isBlackSquare(i * 50, j * 50))
+			{
+				int actual_square_contents = GROUND_TRUTH_BOARDS[still.image_index][square_number - 1];
+				if (isPieceInSquare(occupancy[square_number - 1], still.parameters.occupancy_threshold))
+				{
+					if (is_black_piece[square_number - 1])
+					{
+						updateConfusionMatrix(confusion_matrix, BLACK_MAN_ON_SQUARE, actual_square_contents);
+					}
+					else // it's a white piece
+					{
+						updateConfusionMatrix(confusion_matrix, WHITE_MAN_ON_SQUARE, actual_square_contents);
+					}
+				}
+				else // it's empty
+				{
+					updateConfusionMatrix(confusion_matrix, EMPTY_SQUARE, actual_square_contents);
+				}
+				square_number++;
+			}
+		}
+	}
+}
+
+int part3(Mat empty_board_image, VideoCapture video, TrackingOptions options)
+{
+	// Keep track of board state.
+	BoardStateDetector detector(empty_board_image, options.sparse_squares);
+	MoveTracker tracker(true, (options.motion_gate) ? GATED_CHANGE_PERSISTENCE_FRAMES : CHANGE_PERSISTENCE_FRAMES);
 
 	// Process video frame by frame.
-	Mat current_frame;
 	video.set(cv::CAP_PROP_POS_FRAMES, 1);
-	video >> current_frame;
+	int number_of_frames = 0;
+	if (options.threaded_pipeline)
+	{
+		number_of_frames = trackMovesInPipeline(video, detector, tracker, options);
+	}
+	else
+	{
+		number_of_frames = trackMoves(video, detector, tracker, options);
+	}
+
+	// Compare moves with ground truth.
+	compareMovesWithGroundTruth(tracker.getMoves());
+
+	return number_of_frames;
+}
+
+// Compare the recorded moves with the ground truth for the video.
+void compareMovesWithGroundTruth(vector<Move> moves)
+{
+	cout << moves.size() << endl;
+	int missed_moves = 0;
+	for (const Move actual_move : GROUND_TRUTH_FOR_DRAUGHTSGAME1_VIDEO_MOVES)
+	{
+		bool moveDetected = false;
+		for (const Move& detected_move : moves)
+		{
+			if (isMoveDetected(actual_move, detected_move))
+			{
+				cout << "Move detected - Frame:" << detected_move.frame_number 
+					<< "\tFrom:" << detected_move.from 
+					<< "\tTo:" << detected_move.to << endl;
+				moveDetected = true;
+				break;
+			}
+		}
+		if(!moveDetected)
+		{
+			cout << "\tMove missed - Frame:" << actual_move.frame_number
+				<< "\tFrom:" << actual_move.from
+				<< "\tTo:" << actual_move.to << endl;
+			missed_moves++;
+		}
+	}
+	cout << "Missed " << missed_moves << " moves." << endl;
+}
+
+// Whether a detected move matches a ground truth move.
+bool isMoveDetected(const Move& actual_move, const Move& detected_move)
+{
+	return abs(actual_move.frame_number - detected_move.frame_number) <= 10
+		//&& actual_move.piece == detected_move.piece
+		&& actual_move.from == detected_move.from
+		&& actual_move.to == detected_move.to;
+}
+
+// Track the moves in the video, processing one frame at a time.
+int trackMoves(VideoCapture& video, BoardStateDetector& detector, MoveTracker& tracker, TrackingOptions options)
+{
+	FrameAnalysis analysis;
+	FrameWorkspace workspace;
+	video >> analysis.frame;
 	double last_time = static_cast<double>(getTickCount());
 	double frame_rate = video.get(cv::CAP_PROP_FPS);
 	double time_between_frames = 1000.0 / frame_rate;
-	map<int, DifferenceLog*> square_diff_log;
-	vector<SquareChange*> square_changes;
-	vector<Move*> moves;
-	for(int frame = 0; !current_frame.empty(); frame++)
+	int number_of_frames = 0;
+	MotionGate gate;
+	FrameDeduplicator deduplicator;
+	for (analysis.frame_number = 0; !analysis.frame.empty(); analysis.frame_number++)
+	{
+		if (options.deduplicate_frames && deduplicator.isDuplicate(analysis.frame))
+			detector.reuseAnalysis(analysis, workspace, (options.motion_gate) ? &gate : NULL);
+		else if (options.motion_gate)
+			detector.findMovingPoints(analysis, workspace, gate);
+		else detector.findMovingPoints(analysis, workspace);
+		// Only consider frames with certain number of object pixels.
+		if (analysis.settled && tracker.isFrameConsidered(analysis.object_pixels))
+		{
+			if (!analysis.duplicate)
+				detector.classifySquares(analysis, workspace);
+			tracker.update(analysis);
+		}
+		number_of_frames++;
+		if (options.display_video)
+		{
+			imshow("Draughts video", analysis.board_pt);
+			double current_time = static_cast<double>(getTickCount());
+			double duration = (current_time - last_time) / getTickFrequency() / 1000.0;
+			int delay = (time_between_frames > duration) ? ((int)(time_between_frames - duration)) : 1;
+			last_time = current_time;
+			video >> analysis.frame;
+			char c = cv::waitKey(1);  // If you replace delay with 1 it will play the video as quickly as possible.
+		}
+		else
+		{
+			video >> analysis.frame;
+		}
+	}
+	if (options.display_video)
+	{
+		cv::destroyAllWindows();
+	}
+	return number_of_frames;
+}
+
+// Track the moves in the video using a pipeline of threads (decode -> warp and mask -> classify -> track moves),
+// connected by bounded lock-free queues.  Frames are recycled through a fixed pool so their images are reused.
+// Every frame is classified (as the classifier runs ahead of the tracker) but the tracker only considers the same
+// frames as trackMoves() so the moves recorded are identical.
+int trackMovesInPipeline(VideoCapture& video, BoardStateDetector& detector, MoveTracker& tracker, TrackingOptions options)
+{
+	vector<FrameAnalysis> frame_pool(PIPELINE_FRAMES);
+	SingleProducerSingleConsumerQueue<FrameAnalysis*, PIPELINE_FRAMES> free_frames, decoded_frames, masked_frames, classified_frames;
+	for (int index = 0; index < PIPELINE_FRAMES; index++)
+	{
+		free_frames.push(&frame_pool[index]);
+	}
+	int number_of_cores = max(1, (int)std::thread::hardware_concurrency());
+
+	// Decode stage.
+	std::thread decode_thread([&]()
+	{
+		if (options.pin_threads)
+			PinCurrentThreadToCore(0 % number_of_cores);
+		for (int frame = 0; ; frame++)
+		{
+			FrameAnalysis* analysis = free_frames.pop();
+			video >> analysis->frame;
+			analysis->frame_number = (analysis->frame.empty()) ? END_OF_VIDEO : frame;
+			decoded_frames.push(analysis);
+			if (analysis->frame_number == END_OF_VIDEO)
+				break;
+		}
+	});
+
+	// Warp and mask stage.
+	std::thread mask_thread([&]()
+	{
+		if (options.pin_threads)
+			PinCurrentThreadToCore(1 % number_of_cores);
+		FrameWorkspace workspace;
+		MotionGate gate;
+		for (;;)
+		{
+			FrameAnalysis* analysis = decoded_frames.pop();
+			if ((analysis->frame_number != END_OF_VIDEO) && options.motion_gate)
+				detector.findMovingPoints(*analysis, workspace, gate);
+			else if (analysis->frame_number != END_OF_VIDEO)
+				detector.findMovingPoints(*analysis, workspace);
+			masked_frames.push(analysis);
+			if (analysis->frame_number == END_OF_VIDEO)
+				break;
+		}
+	});
+
+	// Classification stage.
+	std::thread classify_thread([&]()
+	{
+		if (options.pin_threads)
+			PinCurrentThreadToCore(2 % number_of_cores);
+		FrameWorkspace workspace;
+		for (;;)
+		{
+			FrameAnalysis* analysis = masked_frames.pop();
+			if ((analysis->frame_number != END_OF_VIDEO) && analysis->settled)
+				detector.classifySquares(*analysis, workspace);
+			classified_frames.push(analysis);
+			if (analysis->frame_number == END_OF_VIDEO)
+				break;
+		}
+	});
+
+	// Move tracking stage (on this thread, so that the video can be displayed).  If this thread is pinned, the cores it may run on
+	// are restored once the pipeline has finished.
+	vector<int> caller_cores;
+	bool restore_cores = options.pin_threads && GetCurrentThreadCores(caller_cores);
+	if (options.pin_threads)
+		PinCurrentThreadToCore(3 % number_of_cores);
+	int number_of_frames = 0;
+	for (;;)
+	{
+		FrameAnalysis* analysis = classified_frames.pop();
+		if (analysis->frame_number == END_OF_VIDEO)
+			break;
+		if (analysis->settled && tracker.isFrameConsidered(analysis->object_pixels))
+		{
+			tracker.update(*analysis);
+		}
+		number_of_frames++;
+		if (options.display_video)
+		{
+			imshow("Draughts video", analysis->board_pt);
+			cv::waitKey(1);
+		}
+		free_frames.push(analysis);
+	}
+	decode_thread.join();
+	mask_thread.join();
+	classify_thread.join();
+	if (restore_cores)
+		SetCurrentThreadCores(caller_cores);
+	if (options.display_video)
 	{
-		// Perform perspective transformation on current board.
-		Mat current_board_pt = perspectiveTransformation(current_frame);
-
-		// Find difference between empty board and current board (static background model).
-		Mat difference;
-		absdiff(current_board_pt, empty_board_pt, difference);
-		Mat moving_points;
-		cvtColor(difference, moving_points, COLOR_BGR2GRAY);
-		threshold(moving_points, moving_points, 30, 255, THRESH_BINARY);
-		moving_points = opening(moving_points, getStructuringElement3x3());
-		moving_points = dilate(moving_points, getStructuringElement5x5());
-		moving_points = dilate(moving_points, getStructuringElement5x5());
-		//displayImage("moving", moving_points);
-		int object_pixels = getObjectPixelsInImage(moving_points);
-		//cout << "Frame " << frame << " object Pixels: " << object_pixels << endl;
+		cv::destroyAllWindows();
+	}
+	return number_of_frames;
+}
 
-		// Only consider frames with certain number of object pixels.
-		if (object_pixels < (piece_count * PIXELS_IN_SQUARE))
+// Track the moves in a long video by splitting it into segments which are processed in parallel.
+// Each segment opens its own VideoCapture and starts SEGMENT_WARM_UP_FRAMES early, taking its initial board state from the
+// warm-up frames (see MoveTracker::seedBoard).  The segments are then stitched together in order.  A segment which did not
+// establish its board state by its first frame, or whose board state there differs from the board the previous segment tracked
+// up to the seam, is tracked again starting from the previous segment's board, so the tracked board is continuous across seams.
+// Each move is owned by the segment containing its frame.  Square changes still awaiting confirmation at a seam are not carried
+// across it, so moves made right at a seam may still differ from those of a serial run.
+int trackMovesInSegments(string video_filename, Mat empty_board_image, TrackingOptions options)
+{
+	VideoCapture video(video_filename);
+	int total_frames = (int)video.get(cv::CAP_PROP_FRAME_COUNT) - 1;
+	video.release();
+	int number_of_segments = max(1, min(options.segments, total_frames / (2 * SEGMENT_WARM_UP_FRAMES)));
+	BoardStateDetector detector(empty_board_image, options.sparse_squares);
+
+	// Process the segments in parallel.
+	vector<VideoSegment> segments(number_of_segments);
+	vector<std::thread> workers;
+	for (int segment_index = 0; segment_index < number_of_segments; segment_index++)
+	{
+		VideoSegment& segment = segments[segment_index];
+		segment.first_frame = (int)(((long long)total_frames * segment_index) / number_of_segments);
+		segment.end_frame = (segment_index == number_of_segments - 1) ? END_OF_VIDEO : (int)(((long long)total_frames * (segment_index + 1)) / number_of_segments);
+		workers.push_back(std::thread([&segment, &detector, video_filename, options]()
 		{
-			cout << "Frame " << frame << endl;
-			// Get pieces using difference image as mask.
-			Mat pieces_image = Mat::zeros(moving_points.size(), CV_8UC3);
-			current_board_pt.copyTo(pieces_image, moving_points);
-			//displayImage("Pieces", pieces_image);
+			trackMovesInSegment(video_filename, detector, segment, options);
+		}));
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
 
-			// Detect state of current board.
-			int detected_piece_count = 0;
-			for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+	// Stitch the segments together.
+	vector<Move> moves;
+	int number_of_frames = 0;
+	for (int segment_index = 0; segment_index < number_of_segments; segment_index++)
+	{
+		VideoSegment& segment = segments[segment_index];
+		if (segment_index > 0)
+		{
+			// Reconcile the board state at the seam with the board tracked by the previous segment.
+			VideoSegment& previous_segment = segments[segment_index - 1];
+			int differences = 0;
+			for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
 			{
-				if (isPieceInSquare(moving_points, square_number))
-				{
-					if (isBlackPiece(pieces_image, square_number))
-					{
-						current_board[square_number - 1] = BLACK_MAN_ON_SQUARE;
-					}
-					else // it's a white piece
-					{
-						current_board[square_number - 1] = WHITE_MAN_ON_SQUARE;
-					}
-					detected_piece_count++;
-				}
-				else // it's not a piece
-				{
-					current_board[square_number - 1] = EMPTY_SQUARE;
-				}
+				if (previous_segment.board_at_end[square_number] != segment.board_at_start[square_number])
+					differences++;
 			}
-
-			// Record differences between frames.
-			vector<int> diffs;
-			for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
+			if (!segment.board_at_start_known || (differences > 0))
 			{
-				// Difference must go from piece to empty or vice versa.
-				if (previous_board[square_number] != current_board[square_number]
-					&& ((previous_board[square_number] == EMPTY_SQUARE && !(current_board[square_number] == EMPTY_SQUARE))
-						|| (!(previous_board[square_number] == EMPTY_SQUARE) && current_board[square_number] == EMPTY_SQUARE)))
-				{
-					diffs.push_back(square_number);
-					//cout << "Difference at " << square_number + 1 << "\t Was: " << previous_board[square_number] << "\tNow: " << current_board[square_number] << endl;
-				}
+				if (segment.board_at_start_known)
+					cout << differences << " squares differ at the seam at frame " << segment.first_frame << ", retracking the segment" << endl;
+				else cout << "No board state established by the seam at frame " << segment.first_frame << ", retracking the segment" << endl;
+				trackMovesInSegment(video_filename, detector, segment, options, previous_segment.board_at_end);
 			}
-
-			// Check if difference persists across previous frames.
-			for (int i = 0; i < diffs.size(); i++)
+		}
+		for (const Move& move : segment.moves)
+		{
+			if ((move.frame_number < segment.first_frame) || ((segment.end_frame != END_OF_VIDEO) && (move.frame_number >= segment.end_frame)))
+				continue;
+			// Check if move already recorded (by the previous segment, just before the seam).
+			bool moveRecorded = false;
+			for (int k = moves.size() - 1; !moveRecorded && k >= 0 && abs(move.frame_number - moves[k].frame_number) <= 10; k--)
 			{
-				int square_number = diffs[i];
-				if (square_diff_log.count(square_number) == 1)
-				{
-					map<int, DifferenceLog*>::iterator it = square_diff_log.find(square_number);
-					DifferenceLog* log = it->second;
-					// Update square if difference persists across 5 of the previous 10 frames.
-					if (frame - log->first_frame_number <= 10)
-					{
-						if (log->frequency + 1 == 5)
-						{
-							
-							cout << "\tUpdate square " << square_number + 1 << " from " << previous_board[square_number] << " to " << current_board[square_number] << endl;
-							SquareChange* change = new SquareChange(square_number, frame, previous_board[square_number], current_board[square_number]);
-							square_changes.push_back(change);
-							previous_board[square_number] = current_board[square_number];
-							square_diff_log.erase(square_number);
-						}
-						else
-						{
-							log->frequency++;
-						}
-					}
-					else
-					{
-						square_diff_log.erase(square_number);
-						square_diff_log.insert({ square_number, new DifferenceLog(frame) });
-					}
-
-				}
-				else
-				{
-					square_diff_log.insert({ square_number, new DifferenceLog(frame) });
-				}
+				if (moves[k].from == move.from && moves[k].to == move.to && moves[k].piece == move.piece)
+					moveRecorded = true;
 			}
-
-			// Identify moves from updated squares.
-			for (int i = square_changes.size() - 1; i >= 0; i--)
+			if (!moveRecorded)
 			{
-				// Only consider changes in last 10 frames.
-				if (abs(frame - square_changes[i]->frame_number) > 10)
-				{
-					break;
-				}
-				SquareChange* square_change1 = square_changes[i];
-				for (int j = square_changes.size() - 1; j >= 0; j--)
-				{
-					// Only consider changes in last 10 frames.
-					if (abs(frame - square_changes[j]->frame_number) > 10)
-					{
-						break;
-					}
-					SquareChange* square_change2 = square_changes[j];
-					// Check for moves.
-					if ((abs(square_change1->frame_number - square_change2->frame_number) <= 10)
-						&& (square_change1->before != EMPTY_SQUARE) && (square_change2->before == EMPTY_SQUARE)
-						//&& (square_change1->before == square_change2->after) 
-						&& square_change1->square_number != square_change2->square_number)
-					{
-						int from = square_change1->square_number + 1;
-						int to = square_change2->square_number + 1;
-
-						// Check if move already recorded.
-						bool moveRecorded = false;
-						for (int k = 0; !moveRecorded && k < moves.size(); k++)
-						{
-							Move* recorded_move = moves[k];
-							if (abs(frame - recorded_move->frame_number) <= 10
-								&& recorded_move->from == from
-								&& recorded_move->to == to
-								&& recorded_move->piece == square_change1->before)
-							{
-								moveRecorded = true;
-							}
-						}
-						// Record move.
-						if (!moveRecorded)
-						{
-							cout << "\t Move from " << square_change1->square_number + 1 << " to " << square_change2->square_number + 1 << endl;
-							Move* move = new Move(frame, from, to, square_change1->before);
-							moves.push_back(move);
-						}
-					}
-				}
-			}				
-
-			//// Check for any valid moves.
-			//bool moveMade = false;
-			//for (int i = 0; !moveMade && i < square_changes.size(); i++)
-			//{
-			//	SquareChange* square_change1 = square_changes[i];
-			//	for (int j = 0; !moveMade && j < square_changes.size(); j++)
-			//	{
-			//		SquareChange* square_change2 = square_changes[j];
-			//		int from = square_change1->square_number + 1;
-			//		int to = square_change2->square_number + 1;
-			//		if (i != j && !moveMade && isValidMove(previous_board, current_board, from, to))
-			//		{
-			//			cout << "Frame " << frame << endl;
-			//			cout << "\tSwap from " << from << " to " << to << endl;
-			//			executeMove(previous_board, current_board, from, to);
-			//			moveMade = true;
-			//		}
-			//	}
-			//}
-
-			piece_count = detected_piece_count;
-		}
-		imshow("Draughts video", current_board_pt);
-		double current_time = static_cast<double>(getTickCount());
-		double duration = (current_time - last_time) / getTickFrequency() / 1000.0;
-		int delay = (time_between_frames > duration) ? ((int)(time_between_frames - duration)) : 1;
-		last_time = current_time;
-		video >> current_frame;
-		char c = cv::waitKey(1);  // If you replace delay with 1 it will play the video as quickly as possible.
-	}
-	cv::destroyAllWindows();
+				cout << "Frame " << move.frame_number << "\t Move from " << move.from << " to " << move.to << endl;
+				moves.push_back(move);
+			}
+		}
+		number_of_frames += segment.number_of_frames;
+	}
 
 	// Compare moves with ground truth.
-	cout << moves.size() << endl;
-	int missed_moves = 0;
-	for (const Move actual_move : GROUND_TRUTH_FOR_DRAUGHTSGAME1_VIDEO_MOVES)
+	compareMovesWithGroundTruth(moves);
+
+	return number_of_frames;
+}
+
+// Track the moves in one segment of a video (see trackMovesInSegments), starting from the given board state at the first frame
+// of the segment if there is one, otherwise from the initial position (for the first segment) or from the board state established
+// during the warm-up.  If no board state is established by the first frame of the segment, the segment is abandoned there.
+void trackMovesInSegment(string video_filename, BoardStateDetector& detector, VideoSegment& segment, TrackingOptions options, const int* start_board)
+{
+	VideoCapture video(video_filename);
+	MoveTracker tracker(false, (options.motion_gate) ? GATED_CHANGE_PERSISTENCE_FRAMES : CHANGE_PERSISTENCE_FRAMES);
+	MotionGate gate;
+	FrameDeduplicator deduplicator;
+	bool board_known = (segment.first_frame == 0) || (start_board != NULL);
+	if (start_board != NULL)
 	{
-		bool moveDetected = false;
-		for (Move* detected_move : moves)
+		int piece_count = 0;
+		for (int square_number = 0; square_number < NUMBER_OF_SQUARES; square_number++)
 		{
-			if (abs(actual_move.frame_number - detected_move->frame_number) <= 10	
-				//&& actual_move.piece == detected_move->piece
-				&& actual_move.from == detected_move->from
-				&& actual_move.to == detected_move->to)
-			{
-				cout << "Move detected - Frame:" << detected_move->frame_number 
-					<< "\tFrom:" << detected_move->from 
-					<< "\tTo:" << detected_move->to << endl;
-				moveDetected = true;
+			if (start_board[square_number] != EMPTY_SQUARE)
+				piece_count++;
+		}
+		tracker.setBoard(start_board, piece_count);
+	}
+	int warm_up_frame = (board_known) ? segment.first_frame : max(0, segment.first_frame - SEGMENT_WARM_UP_FRAMES);
+	video.set(cv::CAP_PROP_POS_FRAMES, 1 + warm_up_frame);
+	FrameAnalysis analysis;
+	FrameWorkspace workspace;
+	video >> analysis.frame;
+	segment.number_of_frames = 0;
+	segment.moves.clear();
+	segment.board_at_start_known = board_known;
+	for (analysis.frame_number = warm_up_frame; !analysis.frame.empty(); analysis.frame_number++)
+	{
+		if (analysis.frame_number == segment.first_frame)
+		{
+			segment.board_at_start_known = board_known;
+			tracker.getBoard(segment.board_at_start);
+			if (!board_known)
 				break;
+		}
+		if (analysis.frame_number == segment.end_frame)
+			break;
+		if (!board_known)
+		{
+			// Establish the board state during the warm-up (rather than assuming the initial position).  Every warm-up frame is
+			// classified, even with the motion gate (which only settles every few frames on a still board, too rarely to confirm the
+			// board within the warm-up), but the gate is still updated so that it is in the same state at the first frame as it
+			// would be in a serial run.
+			if (options.deduplicate_frames && deduplicator.isDuplicate(analysis.frame))
+				detector.reuseAnalysis(analysis, workspace, NULL);
+			else
+			{
+				detector.findMovingPoints(analysis, workspace);
+				detector.classifySquares(analysis, workspace);
 			}
+			if (options.motion_gate)
+				gate.update(analysis.board_pt);
+			board_known = tracker.seedBoard(analysis);
 		}
-		if(!moveDetected)
+		else
 		{
-			cout << "\tMove missed - Frame:" << actual_move.frame_number
-				<< "\tFrom:" << actual_move.from
-				<< "\tTo:" << actual_move.to << endl;
-			missed_moves++;
+			// (The first frame always counts as settled and is never a duplicate, so its moving points are always found.)
+			if (options.deduplicate_frames && deduplicator.isDuplicate(analysis.frame))
+				detector.reuseAnalysis(analysis, workspace, (options.motion_gate) ? &gate : NULL);
+			else if (options.motion_gate)
+				detector.findMovingPoints(analysis, workspace, gate);
+			else detector.findMovingPoints(analysis, workspace);
+			if (analysis.settled && tracker.isFrameConsidered(analysis.object_pixels))
+			{
+				if (!analysis.duplicate)
+					detector.classifySquares(analysis, workspace);
+				tracker.update(analysis);
+			}
 		}
+		if (analysis.frame_number >= segment.first_frame)
+			segment.number_of_frames++;
+		video >> analysis.frame;
 	}
-	cout << "Missed " << missed_moves << " moves." << endl;
+	tracker.getBoard(segment.board_at_end);
+	segment.moves = tracker.getMoves();
 }
 
 void part4(Mat board_image)
@@ -897,95 +3214,59 @@ void part4(Mat board_image)
 	findCorners(board_image);
 }
 
-void part5(Mat empty_board_image, int extended_confusion_matrix[5][5])
+// Classify the pieces in the squares of a static image as white or black men or kings, updating the extended confusion matrix.
+void part5(StillImage& still, int extended_confusion_matrix[5][5])
 {
-	// Perform perspective transformation on empty board.
-	Mat empty_board_pt = perspectiveTransformation(empty_board_image);
-
-	// Otsu Threshold empty board image.
-	Mat grey_board_image;
-	cvtColor(empty_board_pt, grey_board_image, COLOR_BGR2GRAY);
-	Mat thresholded_board_image;
-	threshold(grey_board_image, thresholded_board_image, 127, 255, THRESH_BINARY | THRESH_OTSU);
-	//displayImage("Thresholded Board Image", thresholded_board_image);
-
-	// Tidy with opening to get binary empty board.
-	Mat binary_empty_board = opening(thresholded_board_image, getStructuringElement5x5());
-	//displayImage("Binary Empty Board", binary_empty_board);
-
-	// Process all static images.
-	for (int image_index = 0; image_index < NUMBER_OF_STATIC_IMAGES; image_index++)
+	// Get pieces using difference image (with the additional closing) as mask.
+	/*Mat pieces_image = Mat::zeros(still.closed_points.size(), CV_8UC3);
+	still.board_pt.copyTo(pieces_image, still.closed_points);
+	displayImage("Pieces", pieces_image);*/
+
+	// Identify pieces in squares by observing the hue histogram in squares.
+	float occupancy[NUMBER_OF_SQUARES];
+	getSquareOccupancy(still.closed_mask, occupancy);
+	Mat board_hsv;
+	bool is_black_piece[NUMBER_OF_SQUARES];
+	float colour_margin[NUMBER_OF_SQUARES];
+	getPieceColours(still.board_pt, still.closed_points, board_hsv, is_black_piece, colour_margin, still.parameters.hue_bins);
+	int square_number = 1;
+	for (int i = 0; i < 8; i++)
 	{
-		//cout << "Image " << image_index << endl;
-		// Load current board image.
-		string filename = "Media/" + GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][0];
-		Mat current_board_image = imread(filename, -1);
-		if (current_board_image.empty())
+		for (int j = 0; j < 8; j++)
 		{
-			cout << "Cannot open image file: " << filename << endl;
-		}
-
-		// Perform perspective transformation on current board.
-		Mat current_board_pt = perspectiveTransformation(current_board_image);
-
-		// Find difference between empty board and current board (static background model).
-		Mat difference;
-		absdiff(current_board_pt, empty_board_pt, difference);
-		Mat moving_points;
-		cvtColor(difference, moving_points, COLOR_BGR2GRAY);
-		threshold(moving_points, moving_points, 30, 255, THRESH_BINARY);
-		moving_points = opening(moving_points, getStructuringElement3x3());
-		moving_points = dilate(moving_points, getStructuringElement5x5());
-		moving_points = dilate(moving_points, getStructuringElement5x5());
-		moving_points = closing(moving_points, getStructuringElement3x3());
-		//displayImage("moving", moving_points);
-
-		// Get pieces using difference image as mask.
-		Mat pieces_image = Mat::zeros(moving_points.size(), CV_8UC3);
-		current_board_pt.copyTo(pieces_image, moving_points);
-		//displayImage("Pieces", pieces_image);
-
-		// Identify pieces in squares by observing the hue histogram in squares.
-		int square_number = 1;
-		for (int i = 0; i < 8; i++)
-		{
-			for (int j = 0; j < 8; j++)
+			if (isBlackSquare(i * 50, j * 50))
 			{
-				if (isBlackSquare(i * 50, j * 50))
+				int actual_square_contents = GROUND_TRUTH_BOARDS_WITH_KINGS[still.image_index][square_number - 1];
+				if (isPieceInSquare(occupancy[square_number - 1], still.parameters.occupancy_threshold))
 				{
-					//cout << square_number << endl;
-					int actual_square_contents = checkBoardGroundTruthWithKings(square_number, GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][1], GROUND_TRUTH_FOR_BOARD_IMAGES[image_index][2]);
-					if (isPieceInSquare(moving_points, i * 50, j * 50))
+					if (is_black_piece[square_number - 1])
 					{
-						if (isBlackPiece(pieces_image, i * 50, j * 50))
+						if (isKing(still.closed_points, i * 50, j * 50, still.parameters.king_circularity_threshold))
 						{
-							if (isKing(moving_points, i * 50, j * 50))
-							{
-								updateExtendedConfusionMatrix(extended_confusion_matrix, BLACK_KING_ON_SQUARE, actual_square_contents);
-							}
-							else // it's a black man
-							{
-								updateExtendedConfusionMatrix(extended_confusion_matrix, BLACK_MAN_ON_SQUARE, actual_square_contents);
-							}
+							updateExtendedConfusionMatrix(extended_confusion_matrix, BLACK_KING_ON_SQUARE, actual_square_contents);
 						}
-						else // it's a white piece
+						else // it's a black man
 						{
-							if (isKing(moving_points, i * 50, j * 50))
-							{
-								updateExtendedConfusionMatrix(extended_confusion_matrix, WHITE_KING_ON_SQUARE, actual_square_contents);
-							}
-							else // it's a white man
-							{
-								updateExtendedConfusionMatrix(extended_confusion_matrix, WHITE_MAN_ON_SQUARE, actual_square_contents);
-							}
+							updateExtendedConfusionMatrix(extended_confusion_matrix, BLACK_MAN_ON_SQUARE, actual_square_contents);
 						}
 					}
-					else // it's not a piece
+					else // it's a white piece
 					{
-						updateExtendedConfusionMatrix(extended_confusion_matrix, EMPTY_SQUARE, actual_square_contents);
+						if (isKing(still.closed_points, i * 50, j * 50, still.parameters.king_circularity_threshold))
+						{
+							updateExtendedConfusionMatrix(extended_confusion_matrix, WHITE_KING_ON_SQUARE, actual_square_contents);
+						}
+						else // it's a white man
+						{
+							updateExtendedConfusionMatrix(extended_confusion_matrix, WHITE_MAN_ON_SQUARE, actual_square_contents);
+						}
 					}
-					square_number++;
 				}
+				else // it's not a piece
+				{
+					updateExtendedConfusionMatrix(extended_confusion_matrix, EMPTY_SQUARE, actual_square_contents);
+				}
+				square_number++;
 			}
 		}
 	}
@@ -1013,36 +3294,60 @@ void displayImage(string name, Mat image)
     imshow(name, image);
 }
 
-// Get the number of object pixels in the given binary image.
-int getObjectPixelsInImage(Mat binary_image)
+// Get the fraction of each dark square which is object pixels in a binary board image (or a square-major image of the dark squares,
+// see BoardWarp::warpSquares), in a single pass over the image.  Returns the number of object pixels in the whole image.
+int getSquareOccupancy(Mat binary_image, float occupancy[NUMBER_OF_SQUARES])
 {
-	int count = 0;
-	for (int i = 0; i < binary_image.rows; i++)
+	bool square_major = (binary_image.rows == NUMBER_OF_SQUARES * SQUARE_DIMENSIONS_IN_PIXELS);
+	int object_pixels_in_square[NUMBER_OF_SQUARES] = { 0 };
+	int object_pixels = 0;
+	for (int row = 0; row < binary_image.rows; row++)
 	{
-		for (int j = 0; j < binary_image.cols; j++)
+		const uchar* pixels = binary_image.ptr<uchar>(row);
+		int top_left_y = row - (row % SQUARE_DIMENSIONS_IN_PIXELS);
+		for (int top_left_x = 0; top_left_x < binary_image.cols; top_left_x += SQUARE_DIMENSIONS_IN_PIXELS)
 		{
-			int pixel = binary_image.at<uchar>(j, i);
-			if (pixel == 255)
+			// Count the object pixels in this row of the square.
+			int end = min(top_left_x + SQUARE_DIMENSIONS_IN_PIXELS, binary_image.cols);
+			int count = 0;
+			for (int column = top_left_x; column < end; column++)
 			{
-				count++;
+				count += (pixels[column] == 255);
 			}
+			object_pixels += count;
+
+			int square_number = -1;
+			if (square_major)
+				square_number = (row / SQUARE_DIMENSIONS_IN_PIXELS) + 1;
+			else if ((end == top_left_x + SQUARE_DIMENSIONS_IN_PIXELS) && isBlackSquare(top_left_x, top_left_y))
+				square_number = getSquare(top_left_x, top_left_y);
+			if ((square_number >= 1) && (square_number <= NUMBER_OF_SQUARES))
+				object_pixels_in_square[square_number - 1] += count;
 		}
 	}
-	return count;
+	for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+	{
+		occupancy[square_number - 1] = object_pixels_in_square[square_number - 1] / (float)PIXELS_IN_SQUARE;
+	}
+	return object_pixels;
 }
 
 // Perform perspective transformation on board image.
 Mat perspectiveTransformation(Mat board_image)
 {
-	Mat result = Mat::zeros(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS, board_image.type());
-	Point2f source[4] = { Point2f(114.0, 17.0), Point2f(53.0, 245.0), Point2f(355.0, 20.0), Point2f(433.0, 241.0) };
-	Point2f destination[4] = { Point2f(0, 0), Point2f(0, BOARD_DIMENSIONS_IN_PIXELS), Point2f(BOARD_DIMENSIONS_IN_PIXELS, 0), Point2f(BOARD_DIMENSIONS_IN_PIXELS, BOARD_DIMENSIONS_IN_PIXELS) };
-	Mat perspective_matrix = getPerspectiveTransform(source, destination);
-	warpPerspective(board_image, result, perspective_matrix, result.size());
+	Mat result;
+	perspectiveTransformation(board_image, result);
 	//displayImage("Perspective Transformation", result);
 	return result;
 }
 
+// Perform perspective transformation on board image into the given result (which is only reallocated if necessary).
+void perspectiveTransformation(Mat board_image, Mat& result)
+{
+	static BoardWarp board_warp;
+	board_warp.warp(board_image, result);
+}
+
 // Create a 3x3 structuring element.
 Mat getStructuringElement3x3()
 {
@@ -1076,7 +3381,7 @@ Mat dilate(Mat binary_image, Mat structuring_element)
 Mat opening(Mat binary_image, Mat structuring_element)
 {
 	Mat opened_image;
-	morphologyEx(binary_image, opened_image, MORPH_OPEN, structuring_element);
+	opening(binary_image, opened_image, structuring_element);
 	return opened_image;
 }
 
@@ -1084,10 +3389,34 @@ Mat opening(Mat binary_image, Mat structuring_element)
 Mat closing(Mat binary_image, Mat structuring_element)
 {
 	Mat closed_image;
-	morphologyEx(binary_image, closed_image, MORPH_CLOSE, structuring_element);
+	closing(binary_image, closed_image, structuring_element);
 	return closed_image;
 }
 
+// Perform an erosion using given structuring element into the given result (which is only reallocated if necessary).
+void erode(Mat binary_image, Mat& eroded_image, Mat structuring_element)
+{
+	cv::erode(binary_image, eroded_image, structuring_element);
+}
+
+// Perform a dilation using given structuring element into the given result (which is only reallocated if necessary).
+void dilate(Mat binary_image, Mat& dilated_image, Mat structuring_element)
+{
+	cv::dilate(binary_image, dilated_image, structuring_element);
+}
+
+// Perform an opening using given structuring element into the given result (which is only reallocated if necessary).
+void opening(Mat binary_image, Mat& opened_image, Mat structuring_element)
+{
+	morphologyEx(binary_image, opened_image, MORPH_OPEN, structuring_element);
+}
+
+// Perform a closing using given structuring element into the given result (which is only reallocated if necessary).
+void closing(Mat binary_image, Mat& closed_image, Mat structuring_element)
+{
+	morphologyEx(binary_image, closed_image, MORPH_CLOSE, structuring_element);
+}
+
 // Get square number from top-left coordinates.
 int getSquare(int x, int y)
 {
@@ -1114,6 +3443,18 @@ void getSquareCoordinates(int square_number, int coordinates[2])
 	}
 }
 
+// Extract the given square from a board image or from a square-major image of the dark squares (see BoardWarp::warpSquares).
+Mat getSquareImage(Mat image, int square_number)
+{
+	if (image.rows == NUMBER_OF_SQUARES * SQUARE_DIMENSIONS_IN_PIXELS)
+	{
+		return image.rowRange((square_number - 1) * SQUARE_DIMENSIONS_IN_PIXELS, square_number * SQUARE_DIMENSIONS_IN_PIXELS);
+	}
+	int coordinates[2] = { -1, -1 };
+	getSquareCoordinates(square_number, coordinates);
+	return image(Rect(coordinates[0], coordinates[1], SQUARE_DIMENSIONS_IN_PIXELS, SQUARE_DIMENSIONS_IN_PIXELS));
+}
+
 // Check if a given square is a black square based on location.
 bool isBlackSquare(int top_left_x, int top_left_y)
 {
@@ -1126,46 +3467,43 @@ bool isBlackSquare(int top_left_x, int top_left_y)
 	return is_black_square;
 }
 
-// Get the number of object pixels found in a chess square.
-int getNumberOfObjectPixelsInSquare(Mat binary_image, int top_left_x, int top_left_y)
+// Get the fraction of each dark square which is set in a bit-packed board mask, counting the bits with popcount.
+// Returns the number of set pixels in the whole mask.
+int getSquareOccupancy(BinaryMask& mask, float occupancy[NUMBER_OF_SQUARES])
 {
+	bool square_major = (mask.rows() == NUMBER_OF_SQUARES * SQUARE_DIMENSIONS_IN_PIXELS);
+	int object_pixels_in_square[NUMBER_OF_SQUARES] = { 0 };
 	int object_pixels = 0;
-	for (int i = top_left_x; i < top_left_x + SQUARE_DIMENSIONS_IN_PIXELS; i++)
+	for (int row = 0; row < mask.rows(); row++)
 	{
-		for (int j = top_left_y; j < top_left_y + SQUARE_DIMENSIONS_IN_PIXELS; j++)
+		int top_left_y = row - (row % SQUARE_DIMENSIONS_IN_PIXELS);
+		for (int top_left_x = 0; top_left_x < mask.columns(); top_left_x += SQUARE_DIMENSIONS_IN_PIXELS)
 		{
-			int pixel = binary_image.at<uchar>(j, i);
-			if (pixel == 255)
-			{
-				object_pixels++;
-			}
+			int end = min(top_left_x + SQUARE_DIMENSIONS_IN_PIXELS, mask.columns());
+			int count = mask.countObjectPixels(row, top_left_x, end);
+			object_pixels += count;
+
+			int square_number = -1;
+			if (square_major)
+				square_number = (row / SQUARE_DIMENSIONS_IN_PIXELS) + 1;
+			else if ((end == top_left_x + SQUARE_DIMENSIONS_IN_PIXELS) && isBlackSquare(top_left_x, top_left_y))
+				square_number = getSquare(top_left_x, top_left_y);
+			if ((square_number >= 1) && (square_number <= NUMBER_OF_SQUARES))
+				object_pixels_in_square[square_number - 1] += count;
 		}
 	}
-	return object_pixels;
-}
-
-// Check if a given square contains a piece.
-bool isPieceInSquare(Mat binary_image, int top_left_x, int top_left_y)
-{
-	bool is_piece_in_square = false;
-	int object_pixels_in_square = getNumberOfObjectPixelsInSquare(binary_image, top_left_x, top_left_y);
-	if (object_pixels_in_square > PIXELS_IN_SQUARE / 4)
+	for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
 	{
-		is_piece_in_square = true;
+		occupancy[square_number - 1] = object_pixels_in_square[square_number - 1] / (float)PIXELS_IN_SQUARE;
 	}
-	return is_piece_in_square;
+	return object_pixels;
 }
 
-// Check if a given square contains a piece.
-bool isPieceInSquare(Mat binary_image, int square_number)
+// Check if a given square contains a piece (from the fraction of the square which is object pixels, see getSquareOccupancy).
+bool isPieceInSquare(float square_occupancy, float occupancy_threshold)
 {
 	bool is_piece_in_square = false;
-
-	int coordinates[2] = { -1, -1 };
-	getSquareCoordinates(square_number, coordinates);
-
-	int object_pixels_in_square = getNumberOfObjectPixelsInSquare(binary_image, coordinates[0], coordinates[1]);
-	if (object_pixels_in_square > PIXELS_IN_SQUARE / 4)
+	if (square_occupancy > occupancy_threshold)
 	{
 		is_piece_in_square = true;
 	}
@@ -1199,34 +3537,65 @@ bool isBlackPiece(Mat rgb_image, int top_left_x, int top_left_y)
 	return is_black_piece;
 }
 
-// Check what colour piece is within a given square.
-bool isBlackPiece(Mat rgb_image, int square_number)
+// Decide the colour of the pieces in all of the dark squares of a board image (or a square-major image of the dark squares,
+// see BoardWarp::warpSquares) in one pass, considering only the pixels set in the binary image.
+// This gives the same decisions as isBlackPiece on the masked board, which compares bins 1 and 2 of a 25 bin hue histogram of each square,
+// and also returns (bin 1 - bin 2) / (bin 1 + bin 2) for each square as a measure of confidence.  Other numbers of bins can be given.
+void getPieceColours(Mat rgb_image, Mat binary_image, Mat& hsv_image, bool is_black_piece[NUMBER_OF_SQUARES], float colour_margin[NUMBER_OF_SQUARES], int number_of_hue_bins)
 {
-	bool is_black_piece = false;
-
-	int coordinates[2] = { -1, -1 };
-	getSquareCoordinates(square_number, coordinates);
-
-	// Extract square from image.
-	Range rows(coordinates[0], coordinates[0] + SQUARE_DIMENSIONS_IN_PIXELS);
-	Range cols(coordinates[1], coordinates[1] + SQUARE_DIMENSIONS_IN_PIXELS);
-	Mat square_image = rgb_image(cols, rows);
-	//displayImage(to_string(top_left_y), square_image);
-
-	// Histogram hue from square.
-	Mat hist = hueHistogram(square_image, 25);
-	//displayHistogram(to_string(top_left_y), hist, 25);
-	//cout << "hist bin 0: " << to_string(hist.at<float>(0)) << endl; // Black Background
-	//cout << "hist bin 1: " << to_string(hist.at<float>(1)) << endl; // Black piece
-	//cout << "hist bin 2: " << to_string(hist.at<float>(2)) << endl; // White piece
-
-	// Compare bins.
-	if (hist.at<float>(1) > hist.at<float>(2))
+	// Hue histogram bin of each hue value (computed as in calcHist).  The table for the default number of bins is initialised once,
+	// safely even when called from several threads.
+	auto compute_hue_bins = [](int number_of_bins)
 	{
-		is_black_piece = true;
+		vector<int> bins(256);
+		for (int hue = 0; hue < 256; hue++)
+		{
+			bins[hue] = cvFloor(hue * (number_of_bins / 180.0));
+		}
+		return bins;
+	};
+	static const vector<int> default_hue_bins = compute_hue_bins(PIECE_COLOUR_HUE_BINS);
+	vector<int> other_hue_bins;
+	if (number_of_hue_bins != PIECE_COLOUR_HUE_BINS)
+		other_hue_bins = compute_hue_bins(number_of_hue_bins);
+	const vector<int>& hue_bins = other_hue_bins.empty() ? default_hue_bins : other_hue_bins;
+
+	cvtColor(rgb_image, hsv_image, COLOR_BGR2HSV);
+	bool square_major = (rgb_image.rows == NUMBER_OF_SQUARES * SQUARE_DIMENSIONS_IN_PIXELS);
+	int black_pixels[NUMBER_OF_SQUARES] = { 0 };
+	int white_pixels[NUMBER_OF_SQUARES] = { 0 };
+	for (int row = 0; row < rgb_image.rows; row++)
+	{
+		const uchar* hsv_pixels = hsv_image.ptr<uchar>(row);
+		const uchar* mask_pixels = binary_image.ptr<uchar>(row);
+		int top_left_y = row - (row % SQUARE_DIMENSIONS_IN_PIXELS);
+		for (int top_left_x = 0; top_left_x + SQUARE_DIMENSIONS_IN_PIXELS <= rgb_image.cols; top_left_x += SQUARE_DIMENSIONS_IN_PIXELS)
+		{
+			int square_number = -1;
+			if (square_major)
+				square_number = (row / SQUARE_DIMENSIONS_IN_PIXELS) + 1;
+			else if (isBlackSquare(top_left_x, top_left_y))
+				square_number = getSquare(top_left_x, top_left_y);
+			if ((square_number < 1) || (square_number > NUMBER_OF_SQUARES))
+				continue;
+			for (int column = top_left_x; column < top_left_x + SQUARE_DIMENSIONS_IN_PIXELS; column++)
+			{
+				if (mask_pixels[column] != 0)
+				{
+					int bin = hue_bins[hsv_pixels[3 * column]];
+					black_pixels[square_number - 1] += (bin == 1);
+					white_pixels[square_number - 1] += (bin == 2);
+				}
+			}
+		}
+	}
+	for (int square_number = 1; square_number <= NUMBER_OF_SQUARES; square_number++)
+	{
+		int black = black_pixels[square_number - 1];
+		int white = white_pixels[square_number - 1];
+		is_black_piece[square_number - 1] = (black > white);
+		colour_margin[square_number - 1] = (black + white > 0) ? (black - white) / (float)(black + white) : 0.0f;
 	}
-
-	return is_black_piece;
 }
 
 // Check whether a given move is valid.
@@ -1316,7 +3685,7 @@ void executeMove(int previous_board[NUMBER_OF_SQUARES], int current_board[NUMBER
 }
 
 // Check whether the piece is a king or not.
-bool isKing(Mat binary_image, int top_left_x, int top_left_y)
+bool isKing(Mat binary_image, int top_left_x, int top_left_y, double circularity_threshold)
 {
 	bool isKing = false;
 	// Extract square from image.
@@ -1342,87 +3711,13 @@ bool isKing(Mat binary_image, int top_left_x, int top_left_y)
 	//cout << "contour arc length:" << perimeter << endl;
 	double circularity = (4 * (2 * acos(0.0)) * area) / (perimeter * perimeter);
 	//cout << "contour circularity:" << circularity << endl;
-	if (circularity < 0.80)
+	if (circularity < circularity_threshold)
 	{
 		isKing = true;
 	}
 	return isKing;
 }
 
-// Check the ground truth for what the specified square should contain.
-int checkBoardGroundTruth(int square_number, string white_pieces, string black_pieces)
-{
-	int ground_truth = EMPTY_SQUARE;
-
-	// Check if it should be a white piece.
-	regex rgx(",");
-	sregex_token_iterator white_iterator(white_pieces.begin(), white_pieces.end(), rgx, -1);
-	sregex_token_iterator white_end;
-	for (; ground_truth == EMPTY_SQUARE && white_iterator != white_end; ++white_iterator)
-	{
-		string current_square = *white_iterator;
-		if (current_square == to_string(square_number) || (current_square == "K" + to_string(square_number)))
-		{
-			ground_truth = WHITE_MAN_ON_SQUARE;
-		}
-	}
-
-	// Check if it should be a black piece.
-	sregex_token_iterator black_iterator(black_pieces.begin(), black_pieces.end(), rgx, -1);
-	sregex_token_iterator black_end;
-	for (; ground_truth == EMPTY_SQUARE && black_iterator != black_end; ++black_iterator)
-	{
-		string current_square = *black_iterator;
-		if (current_square == to_string(square_number) || (current_square == "K" + to_string(square_number)))
-		{
-			ground_truth = BLACK_MAN_ON_SQUARE;
-		}
-	}
-
-	return ground_truth;
-}
-
-// Check the ground truth for what the specified square should contain including kings.
-int checkBoardGroundTruthWithKings(int square_number, string white_pieces, string black_pieces)
-{
-	int ground_truth = EMPTY_SQUARE;
-
-	// Check if it should be a white man or king.
-	regex rgx(",");
-	sregex_token_iterator white_iterator(white_pieces.begin(), white_pieces.end(), rgx, -1);
-	sregex_token_iterator white_end;
-	for (; ground_truth == EMPTY_SQUARE && white_iterator != white_end; ++white_iterator)
-	{
-		string current_square = *white_iterator;
-		if (current_square == to_string(square_number))
-		{
-			ground_truth = WHITE_MAN_ON_SQUARE;
-		}
-		else if (current_square == "K" + to_string(square_number))
-		{
-			ground_truth = WHITE_KING_ON_SQUARE;
-		}
-	}
-
-	// Check if it should be a black man or king.
-	sregex_token_iterator black_iterator(black_pieces.begin(), black_pieces.end(), rgx, -1);
-	sregex_token_iterator black_end;
-	for (; ground_truth == EMPTY_SQUARE && black_iterator != black_end; ++black_iterator)
-	{
-		string current_square = *black_iterator;
-		if (current_square == to_string(square_number))
-		{
-			ground_truth = BLACK_MAN_ON_SQUARE;
-		}
-		else if (current_square == "K" + to_string(square_number))
-		{
-			ground_truth = BLACK_KING_ON_SQUARE;
-		}
-	}
-
-	return ground_truth;
-}
-
 // Update the confusion matrix based on what was detected in the square and what was recorded in the ground truth.
 void updateConfusionMatrix(int confusion_matrix[3][3], int detected_square_contents, int actual_square_contents)
 {
@@ -1610,9 +3905,16 @@ void updateExtendedConfusionMatrix(int extended_confusion_matrix[5][5], int dete
 // Extract Hue channel from RGB image converted to HSV image.
 Mat extractHue(Mat rgb_image)
 {
-    // Convert RGB to HSV.
     Mat hue;
     Mat hsv_image;
+    extractHue(rgb_image, hsv_image, hue);
+    return hue;
+}
+
+// Extract the hue channel from the provided RGB image into the given buffers (which are only reallocated if necessary).
+void extractHue(Mat rgb_image, Mat& hsv_image, Mat& hue)
+{
+    // Convert RGB to HSV.
     cvtColor(rgb_image, hsv_image, COLOR_BGR2HSV);
     //DisplayImage("HSV", hsv_image);
 
@@ -1621,27 +3923,32 @@ Mat extractHue(Mat rgb_image)
     int ch[] = { 0, 0 };
     mixChannels(&hsv_image, 1, &hue, 1, ch, 1);
     //DisplayImage("Hue", hue);
-
-    return hue;
 }
 
 // Create a hue histogram from the provided RGB image.
 Mat hueHistogram(Mat rgb_image, int bins)
+{
+    Mat hsv_image;
+    Mat hue;
+    Mat hist;
+    hueHistogram(rgb_image, bins, hsv_image, hue, hist);
+    return hist;
+}
+
+// Create a hue histogram from the provided RGB image into the given buffers (which are only reallocated if necessary).
+void hueHistogram(Mat rgb_image, int bins, Mat& hsv_image, Mat& hue, Mat& hist)
 {
     // Extract hue channel.
-    Mat hue = extractHue(rgb_image);
+    extractHue(rgb_image, hsv_image, hue);
     
     // Create histogram.
     int histSize = MAX(bins, 2);
     float hue_range[] = { 0, 180 };
     const float* ranges[] = { hue_range };
-    Mat hist;
     calcHist(&hue, 1, 0, Mat(), hist, 1, &histSize, ranges, true, false);
 
     // Normalise histogram.
     normalize(hist, hist, 0, 255, NORM_MINMAX, -1, Mat());
-
-    return hist;
 }
 
 // Display histogram.
@@ -2,12 +2,32 @@
  * This code is provided as part of "A Practical Introduction to Computer Vision with OpenCV"
  * by Kenneth Dawson-Howe  Wiley & Sons Inc. 2014.  All rights reserved.
  */
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#endif
 #include "opencv2/core.hpp"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/video.hpp"
 #include "opencv2/highgui.hpp"
 #include <stdio.h>
+#include <string.h>
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <functional>
 #include "Utilities.h"
 
 using namespace std;
@@ -31,6 +51,458 @@ void ShowHLS(Mat image)
 	imshow("HLS components", output3);
 }
 
+// Restrict the calling thread to run on the given core.  Returns false if this is not supported.
+bool PinCurrentThreadToCore(int core)
+{
+#if defined(_WIN32)
+	return SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << core) != 0;
+#elif defined(__linux__)
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	CPU_SET(core, &cpu_set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+	return false;
+#endif
+}
+
+// Find the cores which the calling thread may run on (e.g. to restore them after pinning it).  Returns false if this is not supported.
+bool GetCurrentThreadCores(vector<int>& cores)
+{
+	cores.clear();
+#if defined(_WIN32)
+	// Windows can only read a thread's affinity by replacing it, so it is replaced with the process affinity and then put back.
+	DWORD_PTR process_mask, system_mask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		return false;
+	DWORD_PTR thread_mask = SetThreadAffinityMask(GetCurrentThread(), process_mask);
+	if (thread_mask == 0)
+		return false;
+	SetThreadAffinityMask(GetCurrentThread(), thread_mask);
+	for (int core = 0; core < (int)(8 * sizeof(thread_mask)); core++)
+		if (thread_mask & (((DWORD_PTR)1) << core))
+			cores.push_back(core);
+	return true;
+#elif defined(__linux__)
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+		return false;
+	for (int core = 0; core < CPU_SETSIZE; core++)
+		if (CPU_ISSET(core, &cpu_set))
+			cores.push_back(core);
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Restrict the calling thread to run on the given cores.  Returns false if this is not supported.
+bool SetCurrentThreadCores(vector<int>& cores)
+{
+#if defined(_WIN32)
+	DWORD_PTR thread_mask = 0;
+	for (int core : cores)
+		thread_mask |= ((DWORD_PTR)1) << core;
+	return SetThreadAffinityMask(GetCurrentThread(), thread_mask) != 0;
+#elif defined(__linux__)
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	for (int core : cores)
+		CPU_SET(core, &cpu_set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+	return false;
+#endif
+}
+
+// Number of horizontal stripes to divide an image with the given number of rows into for parallel processing.
+int NumberOfRowStripes(int rows)
+{
+	return max(1, min(rows, getNumberOfThreads() * ROW_STRIPES_PER_THREAD));
+}
+
+// Rows covered by one of the horizontal stripes of an image.  The stripes depend only on the number of rows and stripes, so results which
+// are combined in stripe order are deterministic whatever the number of threads that process them.
+Range RowStripe(int rows, int stripe, int number_of_stripes)
+{
+	return Range((rows * stripe) / number_of_stripes, (rows * (stripe + 1)) / number_of_stripes);
+}
+
+// Count the number of set bits.
+int PopCount(uint64 bits)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (int)__popcnt64(bits);
+#elif defined(__GNUC__)
+	return __builtin_popcountll(bits);
+#else
+	int count = 0;
+	for (; bits != 0; bits &= bits - 1)
+		count++;
+	return count;
+#endif
+}
+
+// Fixed point weights used by cvtColor(COLOR_BGR2GRAY) for 8 bit images.
+#define GRAY_SHIFT 15
+#define GRAY_BLUE_WEIGHT 3735
+#define GRAY_GREEN_WEIGHT 19235
+#define GRAY_RED_WEIGHT 9798
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__AVX__)
+// Shuffles which deinterleave 16 BGR pixels (in three 16 byte blocks) into blue, green and red channels.
+static const signed char DEINTERLEAVE_BGR[3][3][16] = {
+	{ { 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 } },
+	{ { 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 } },
+	{ { 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+	  { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 } } };
+#endif
+
+// Compute threshold(cvtColor(absdiff(row1, row2), COLOR_BGR2GRAY), threshold_value, 255, THRESH_BINARY) for one row of BGR pixels
+// in a single pass.  The results are bit-exact with the three OpenCV calls.
+static void DifferenceThresholdRow(const uchar* row1, const uchar* row2, uchar* result_row, int width, int threshold_value)
+{
+	int column = 0;
+#if defined(__AVX2__)
+	// 32 pixels at a time (16 in each 128 bit lane).
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i blue_green_weights = _mm256_set1_epi32((GRAY_GREEN_WEIGHT << 16) | GRAY_BLUE_WEIGHT);
+	const __m256i red_rounding_weights = _mm256_set1_epi32((1 << (GRAY_SHIFT - 1 + 16)) | GRAY_RED_WEIGHT);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i threshold = _mm256_set1_epi16((short)threshold_value);
+	__m256i deinterleave[3][3];
+	for (int channel = 0; channel < 3; channel++)
+		for (int block = 0; block < 3; block++)
+			deinterleave[channel][block] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][block]));
+	for (; column + 32 <= width; column += 32)
+	{
+		__m256i difference[3];
+		for (int block = 0; block < 3; block++)
+		{
+			const uchar* pixels1 = row1 + 3 * column + 16 * block;
+			const uchar* pixels2 = row2 + 3 * column + 16 * block;
+			__m256i values1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)pixels1)), _mm_loadu_si128((const __m128i*)(pixels1 + 48)), 1);
+			__m256i values2 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)pixels2)), _mm_loadu_si128((const __m128i*)(pixels2 + 48)), 1);
+			difference[block] = _mm256_or_si256(_mm256_subs_epu8(values1, values2), _mm256_subs_epu8(values2, values1));
+		}
+		__m256i channels[3];
+		for (int channel = 0; channel < 3; channel++)
+		{
+			channels[channel] = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(difference[0], deinterleave[channel][0]),
+				_mm256_shuffle_epi8(difference[1], deinterleave[channel][1])), _mm256_shuffle_epi8(difference[2], deinterleave[channel][2]));
+		}
+		__m256i gray_halves[2];
+		for (int half = 0; half < 2; half++)
+		{
+			__m256i blue = half ? _mm256_unpackhi_epi8(channels[0], zero) : _mm256_unpacklo_epi8(channels[0], zero);
+			__m256i green = half ? _mm256_unpackhi_epi8(channels[1], zero) : _mm256_unpacklo_epi8(channels[1], zero);
+			__m256i red = half ? _mm256_unpackhi_epi8(channels[2], zero) : _mm256_unpacklo_epi8(channels[2], zero);
+			__m256i gray_low = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(blue, green), blue_green_weights),
+				_mm256_madd_epi16(_mm256_unpacklo_epi16(red, ones), red_rounding_weights));
+			__m256i gray_high = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(blue, green), blue_green_weights),
+				_mm256_madd_epi16(_mm256_unpackhi_epi16(red, ones), red_rounding_weights));
+			__m256i gray = _mm256_packs_epi32(_mm256_srli_epi32(gray_low, GRAY_SHIFT), _mm256_srli_epi32(gray_high, GRAY_SHIFT));
+			gray_halves[half] = _mm256_cmpgt_epi16(gray, threshold);
+		}
+		_mm256_storeu_si256((__m256i*)(result_row + column), _mm256_packs_epi16(gray_halves[0], gray_halves[1]));
+	}
+#elif defined(__SSSE3__) || defined(__AVX__)
+	// 16 pixels at a time.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i blue_green_weights = _mm_set1_epi32((GRAY_GREEN_WEIGHT << 16) | GRAY_BLUE_WEIGHT);
+	const __m128i red_rounding_weights = _mm_set1_epi32((1 << (GRAY_SHIFT - 1 + 16)) | GRAY_RED_WEIGHT);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i threshold = _mm_set1_epi16((short)threshold_value);
+	for (; column + 16 <= width; column += 16)
+	{
+		__m128i difference[3];
+		for (int block = 0; block < 3; block++)
+		{
+			__m128i values1 = _mm_loadu_si128((const __m128i*)(row1 + 3 * column + 16 * block));
+			__m128i values2 = _mm_loadu_si128((const __m128i*)(row2 + 3 * column + 16 * block));
+			difference[block] = _mm_or_si128(_mm_subs_epu8(values1, values2), _mm_subs_epu8(values2, values1));
+		}
+		__m128i channels[3];
+		for (int channel = 0; channel < 3; channel++)
+		{
+			channels[channel] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(difference[0], _mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][0])),
+				_mm_shuffle_epi8(difference[1], _mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][1]))),
+				_mm_shuffle_epi8(difference[2], _mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][2])));
+		}
+		__m128i gray_halves[2];
+		for (int half = 0; half < 2; half++)
+		{
+			__m128i blue = half ? _mm_unpackhi_epi8(channels[0], zero) : _mm_unpacklo_epi8(channels[0], zero);
+			__m128i green = half ? _mm_unpackhi_epi8(channels[1], zero) : _mm_unpacklo_epi8(channels[1], zero);
+			__m128i red = half ? _mm_unpackhi_epi8(channels[2], zero) : _mm_unpacklo_epi8(channels[2], zero);
+			__m128i gray_low = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(blue, green), blue_green_weights),
+				_mm_madd_epi16(_mm_unpacklo_epi16(red, ones), red_rounding_weights));
+			__m128i gray_high = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(blue, green), blue_green_weights),
+				_mm_madd_epi16(_mm_unpackhi_epi16(red, ones), red_rounding_weights));
+			__m128i gray = _mm_packs_epi32(_mm_srli_epi32(gray_low, GRAY_SHIFT), _mm_srli_epi32(gray_high, GRAY_SHIFT));
+			gray_halves[half] = _mm_cmpgt_epi16(gray, threshold);
+		}
+		_mm_storeu_si128((__m128i*)(result_row + column), _mm_packs_epi16(gray_halves[0], gray_halves[1]));
+	}
+#endif
+	for (; column < width; column++)
+	{
+		int blue = abs(row1[3 * column] - row2[3 * column]);
+		int green = abs(row1[3 * column + 1] - row2[3 * column + 1]);
+		int red = abs(row1[3 * column + 2] - row2[3 * column + 2]);
+		int gray = (blue * GRAY_BLUE_WEIGHT + green * GRAY_GREEN_WEIGHT + red * GRAY_RED_WEIGHT + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT;
+		result_row[column] = (gray > threshold_value) ? 255 : 0;
+	}
+}
+
+// Find the (binary) points where two BGR images differ, equivalent to absdiff, cvtColor(COLOR_BGR2GRAY) and threshold(THRESH_BINARY)
+// but in a single pass without any intermediate images.  The result is reallocated only if its size or type changes.
+void DifferenceThreshold(Mat& image1, Mat& image2, Mat& result, int threshold_value)
+{
+	CV_Assert((image1.type() == CV_8UC3) && (image2.type() == CV_8UC3) && (image1.size() == image2.size()));
+	result.create(image1.size(), CV_8UC1);
+	threshold_value = max(-1, min(threshold_value, 255));
+	for (int row = 0; row < image1.rows; row++)
+	{
+		DifferenceThresholdRow(image1.ptr<uchar>(row), image2.ptr<uchar>(row), result.ptr<uchar>(row), image1.cols, threshold_value);
+	}
+}
+
+// Split the hue plane from one row of an HLS image and set the mask where saturation - luminance/2 (clipped at 0) exceeds the
+// threshold, in a single pass.
+static void HueAndSaturationMaskRow(const uchar* hls_row, uchar* hue_row, uchar* mask_row, int width, int threshold_value)
+{
+	int column = 0;
+#if defined(__AVX2__)
+	// 32 pixels at a time (16 in each 128 bit lane).
+	const __m256i low_seven_bits = _mm256_set1_epi8(0x7F);
+	const __m256i minimum_difference = _mm256_set1_epi8((char)(threshold_value + 1));
+	__m256i deinterleave[3][3];
+	for (int channel = 0; channel < 3; channel++)
+		for (int block = 0; block < 3; block++)
+			deinterleave[channel][block] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][block]));
+	for (; (threshold_value >= 0) && (threshold_value < 255) && (column + 32 <= width); column += 32)
+	{
+		__m256i values[3];
+		for (int block = 0; block < 3; block++)
+		{
+			const uchar* pixels = hls_row + 3 * column + 16 * block;
+			values[block] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)pixels)), _mm_loadu_si128((const __m128i*)(pixels + 48)), 1);
+		}
+		__m256i channels[3];
+		for (int channel = 0; channel < 3; channel++)
+		{
+			channels[channel] = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(values[0], deinterleave[channel][0]),
+				_mm256_shuffle_epi8(values[1], deinterleave[channel][1])), _mm256_shuffle_epi8(values[2], deinterleave[channel][2]));
+		}
+		__m256i half_luminance = _mm256_and_si256(_mm256_srli_epi16(channels[1], 1), low_seven_bits);
+		__m256i difference = _mm256_subs_epu8(channels[2], half_luminance);
+		_mm256_storeu_si256((__m256i*)(hue_row + column), channels[0]);
+		_mm256_storeu_si256((__m256i*)(mask_row + column), _mm256_cmpeq_epi8(_mm256_max_epu8(difference, minimum_difference), difference));
+	}
+#elif defined(__SSSE3__) || defined(__AVX__)
+	// 16 pixels at a time.
+	const __m128i low_seven_bits = _mm_set1_epi8(0x7F);
+	const __m128i minimum_difference = _mm_set1_epi8((char)(threshold_value + 1));
+	for (; (threshold_value >= 0) && (threshold_value < 255) && (column + 16 <= width); column += 16)
+	{
+		__m128i values[3];
+		for (int block = 0; block < 3; block++)
+			values[block] = _mm_loadu_si128((const __m128i*)(hls_row + 3 * column + 16 * block));
+		__m128i channels[3];
+		for (int channel = 0; channel < 3; channel++)
+		{
+			channels[channel] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(values[0], _mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][0])),
+				_mm_shuffle_epi8(values[1], _mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][1]))),
+				_mm_shuffle_epi8(values[2], _mm_loadu_si128((const __m128i*)DEINTERLEAVE_BGR[channel][2])));
+		}
+		__m128i half_luminance = _mm_and_si128(_mm_srli_epi16(channels[1], 1), low_seven_bits);
+		__m128i difference = _mm_subs_epu8(channels[2], half_luminance);
+		_mm_storeu_si128((__m128i*)(hue_row + column), channels[0]);
+		_mm_storeu_si128((__m128i*)(mask_row + column), _mm_cmpeq_epi8(_mm_max_epu8(difference, minimum_difference), difference));
+	}
+#endif
+	for (; column < width; column++)
+	{
+		int saturation_minus_luminance = max(0, hls_row[3 * column + 2] - hls_row[3 * column + 1] / 2);
+		hue_row[column] = hls_row[3 * column];
+		mask_row[column] = (saturation_minus_luminance > threshold_value) ? 255 : 0;
+	}
+}
+
+// Extract the hue plane of an HLS image and find the (binary) mask of the points where saturation - luminance/2 is above the threshold,
+// equivalent to split, the per-pixel difference (clipped at 0) and threshold(THRESH_BINARY) but in a single pass (over rows in parallel).
+void HueAndSaturationMask(Mat& hls_image, Mat& hue_image, Mat& mask_image, int threshold_value)
+{
+	CV_Assert(hls_image.type() == CV_8UC3);
+	hue_image.create(hls_image.size(), CV_8UC1);
+	mask_image.create(hls_image.size(), CV_8UC1);
+	parallel_for_(Range(0, hls_image.rows), [&](const Range& rows)
+	{
+		for (int row = rows.start; row < rows.end; row++)
+		{
+			HueAndSaturationMaskRow(hls_image.ptr<uchar>(row), hue_image.ptr<uchar>(row), mask_image.ptr<uchar>(row), hls_image.cols, threshold_value);
+		}
+	});
+}
+
+// Map every (CV_32S) index in an image through a table of (8 bit) values, using gathers where AVX2 is available (over rows in parallel).
+void TableLookup(Mat& index_image, const int table[], Mat& result)
+{
+	CV_Assert(index_image.type() == CV_32SC1);
+	result.create(index_image.size(), CV_8UC1);
+	parallel_for_(Range(0, index_image.rows), [&](const Range& rows)
+	{
+		for (int row = rows.start; row < rows.end; row++)
+		{
+			const int* indices = index_image.ptr<int>(row);
+			uchar* result_row = result.ptr<uchar>(row);
+			int column = 0;
+#if defined(__AVX2__)
+			const __m256i byte_order = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+				0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			for (; column <= index_image.cols - 8; column += 8)
+			{
+				__m256i values = _mm256_i32gather_epi32(table, _mm256_loadu_si256((const __m256i*)(indices + column)), 4);
+				values = _mm256_shuffle_epi8(values, byte_order);
+				_mm_storel_epi64((__m128i*)(result_row + column), _mm_unpacklo_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1)));
+			}
+#endif
+			for (; column < index_image.cols; column++)
+				result_row[column] = (uchar)table[indices[column]];
+		}
+	});
+}
+
+// Continue an FNV-1a hash over the given bytes.
+uint64 HashBytes(const void* data, size_t length, uint64 hash)
+{
+	const uchar* bytes = (const uchar*)data;
+	for (size_t index = 0; index < length; index++)
+	{
+		hash ^= bytes[index];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+// Continue an FNV-1a hash over the contents of a file.  Returns false if the file cannot be read.
+bool HashFile(string filename, uint64& hash)
+{
+	ifstream file(filename, ios::binary);
+	if (!file)
+		return false;
+	vector<char> buffer(1 << 16);
+	while (file.read(buffer.data(), buffer.size()) || (file.gcount() > 0))
+	{
+		hash = HashBytes(buffer.data(), (size_t)file.gcount(), hash);
+	}
+	return file.eof();
+}
+
+// Read the dimensions of a JPEG image from its start of frame marker, without decoding the image.  Returns false if the file
+// is not a JPEG (or its dimensions are not given in the frame header).
+bool ReadJpegSize(string filename, Size& size)
+{
+	ifstream file(filename, ios::binary);
+	if ((file.get() != 0xFF) || (file.get() != 0xD8))
+		return false;
+	for (;;)
+	{
+		if (file.get() != 0xFF)
+			return false;
+		int marker = file.get();
+		while (marker == 0xFF)
+			marker = file.get();
+		// The frame header must come before the end of the image or the first scan.
+		if ((marker == EOF) || (marker == 0xD9) || (marker == 0xDA))
+			return false;
+		// Markers without a segment.
+		if ((marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7)))
+			continue;
+		uchar segment_length[2];
+		if (!file.read((char*)segment_length, 2))
+			return false;
+		int length = (segment_length[0] << 8) | segment_length[1];
+		if (length < 2)
+			return false;
+		// Start of frame markers (0xC4, 0xC8 and 0xCC are other markers in the same range).
+		if ((marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC))
+		{
+			uchar frame_header[5];
+			if (!file.read((char*)frame_header, 5))
+				return false;
+			size.height = (frame_header[1] << 8) | frame_header[2];
+			size.width = (frame_header[3] << 8) | frame_header[4];
+			return (size.width > 0) && (size.height > 0);
+		}
+		file.seekg(length - 2, ios::cur);
+	}
+}
+
+// Header of a raw image file, padded to 64 bytes so that the pixels (which follow it row after row with no padding)
+// are aligned if the file is memory mapped.
+struct RawImageHeader
+{
+	char magic[8];
+	uint64 key;
+	int rows;
+	int columns;
+	int type;
+	char padding[36];
+};
+static_assert(sizeof(RawImageHeader) == 64, "The raw image header should be 64 bytes");
+static const char RAW_IMAGE_MAGIC[8] = { 'R', 'A', 'W', 'I', 'M', 'G', '0', '1' };
+
+// Read a raw image file written by WriteRawImage into the image (which is only reallocated if necessary), with no decoding.
+// Returns false if the file does not exist, was written with a different key, does not hold an image of the expected size and
+// type, or is incomplete.
+bool ReadRawImage(string filename, uint64 key, Size expected_size, int expected_type, Mat& image)
+{
+	ifstream file(filename, ios::binary);
+	RawImageHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || (memcmp(header.magic, RAW_IMAGE_MAGIC, sizeof(RAW_IMAGE_MAGIC)) != 0) ||
+		(header.key != key) || (header.rows != expected_size.height) || (header.columns != expected_size.width) || (header.type != expected_type))
+		return false;
+	image.create(expected_size, expected_type);
+	return (bool)file.read((char*)image.data, image.total() * image.elemSize());
+}
+
+// Write an image as a raw image file (a RawImageHeader followed by the pixels), tagged with a key which must match when it is read.
+// The file is written under a temporary name and then renamed, so that readers (e.g. another run sharing the cache) never see
+// a partly written file.
+bool WriteRawImage(string filename, uint64 key, Mat& image)
+{
+	Mat continuous_image = image.isContinuous() ? image : image.clone();
+	RawImageHeader header = {};
+	memcpy(header.magic, RAW_IMAGE_MAGIC, sizeof(RAW_IMAGE_MAGIC));
+	header.key = key;
+	header.rows = continuous_image.rows;
+	header.columns = continuous_image.cols;
+	header.type = continuous_image.type();
+	string temporary_filename = filename + format(".%llx.%llx.tmp", (unsigned long long)getTickCount(),
+		(unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+	ofstream file(temporary_filename, ios::binary | ios::trunc);
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)continuous_image.data, continuous_image.total() * continuous_image.elemSize());
+	file.close();
+	bool written = !file.fail();
+#if defined(_WIN32)
+	written = written && MoveFileExA(temporary_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	written = written && (rename(temporary_filename.c_str(), filename.c_str()) == 0);
+#endif
+	if (!written)
+		remove(temporary_filename.c_str());
+	return written;
+}
+
 void writeText(Mat image, char* text, int row, int column, Scalar passed_colour, double scale, int thickness)
 {
 	string text_str(text);
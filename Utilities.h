@@ -49,10 +49,28 @@ void TrackFeaturesDemo( VideoCapture& video, int starting_frame_number, int endi
 
 Mat BackProjection(Mat query_image, Mat all_images[], int number_of_images);
 Mat BackProjection(Mat query_image, Mat sample_image);
+void MultiBackProjection(Mat query_image, Mat sample_images[], int number_of_samples, Mat probability_images[], int number_of_bins = 8);
 Mat kmeans_clustering(Mat& image, int k, int iterations);
 double ComputeOTSUThreshold(Mat src, Mat mask);
 
 void floodFillPostprocess(Mat& img, const Scalar& colorDiff = Scalar::all(1));
+bool PinCurrentThreadToCore(int core);
+bool GetCurrentThreadCores(vector<int>& cores);
+bool SetCurrentThreadCores(vector<int>& cores);
+#define ROW_STRIPES_PER_THREAD 4
+int NumberOfRowStripes(int rows);
+Range RowStripe(int rows, int stripe, int number_of_stripes);
+int PopCount(uint64 bits);
+void DifferenceThreshold(Mat& image1, Mat& image2, Mat& result, int threshold_value);
+void HueAndSaturationMask(Mat& hls_image, Mat& hue_image, Mat& mask_image, int threshold_value);
+void TableLookup(Mat& index_image, const int table[], Mat& result);
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+uint64 HashBytes(const void* data, size_t length, uint64 hash = FNV_OFFSET_BASIS);
+bool HashFile(string filename, uint64& hash);
+bool ReadRawImage(string filename, uint64 key, Size expected_size, int expected_type, Mat& image);
+bool WriteRawImage(string filename, uint64 key, Mat& image);
+bool ReadJpegSize(string filename, Size& size);
 
 class TimestampEvent {
 private:
@@ -93,6 +111,44 @@ void show_32bit_image( char* window_name, Mat& passed_image, double zero_maps_to
 Mat ComputeDefaultImage( Mat& passed_image );
 void DrawHistogram( MatND histograms[], int number_of_histograms, Mat& display_image );
 void MyApplication();
+// Options for recording the moves in a video.
+struct TrackingOptions
+{
+	// Show the video while it is processed.
+	bool display_video;
+	// Only warp and process the dark squares (see BoardWarp::warpSquares).
+	bool sparse_squares;
+	// Run decoding, warping, classification and move tracking as a pipeline of threads.
+	bool threaded_pipeline;
+	// Pin each stage of the pipeline to its own core.
+	bool pin_threads;
+	// Split the video into this many segments which are processed in parallel.
+	int segments;
+	// Only classify the squares once each time the board settles after motion (see MotionGate).
+	bool motion_gate;
+	// Reuse the analysis of the last frame processed for frames which are almost the same (see FrameDeduplicator).
+	// This is not supported by the threaded pipeline.
+	bool deduplicate_frames;
+
+	TrackingOptions()
+	{
+		this->display_video = true;
+		this->sparse_squares = false;
+		this->threaded_pipeline = false;
+		this->pin_threads = false;
+		this->segments = 1;
+		this->motion_gate = false;
+		this->deduplicate_frames = false;
+	}
+};
+int MyHeadlessApplication(string video_filename, string background_filename, TrackingOptions options);
+int BenchmarkPerspectiveTransformation(string image_filename, int iterations);
+int BenchmarkDifferenceThreshold(string image_filename, string background_filename, int iterations);
+int CheckFrameAllocations(string background_filename);
+int EvaluatePixelClassification(vector<string> image_filenames, vector<string> ground_truth_filenames);
+int SweepStillImageParameters(string background_filename, vector<double> difference_thresholds, vector<double> occupancy_thresholds,
+	vector<double> king_circularity_thresholds, vector<double> hue_bins, vector<double> probability_thresholds, string video_filename,
+	vector<double> change_persistence_frames);
 
 double DistanceBetweenPoints(Point2d point1, Point2d point2);
 double DistanceBetweenPoints(Point2i point1, Point2i point2);
@@ -7,8 +7,134 @@
 using namespace cv;
 using namespace std;
 
+// Parse a comma separated list of numbers.
+vector<double> ParseValues(string list)
+{
+    vector<double> values;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == string::npos)
+            end = list.size();
+        values.push_back(atof(list.substr(start, end - start).c_str()));
+        start = end + 1;
+    }
+    return values;
+}
+
 int main(int argc, char** argv)
 {
+    // Headless move tracking:  draughts-game-analysis --headless <video> [<empty board image>] [--sparse] [--pipeline [--pin]] [--segments <n>] [--motion-gate] [--dedup]
+    // (--dedup is not supported with --pipeline)
+    if ((argc >= 3) && (string(argv[1]) == "--headless"))
+    {
+        TrackingOptions options;
+        string background_filename = "Media/DraughtsGame1EmptyBoard.JPG";
+        for (int argument = 3; argument < argc; argument++)
+        {
+            string option(argv[argument]);
+            if (option == "--sparse")
+                options.sparse_squares = true;
+            else if (option == "--pipeline")
+                options.threaded_pipeline = true;
+            else if (option == "--pin")
+                options.pin_threads = true;
+            else if ((option == "--segments") && (argument + 1 < argc))
+                options.segments = atoi(argv[++argument]);
+            else if (option == "--motion-gate")
+                options.motion_gate = true;
+            else if (option == "--dedup")
+                options.deduplicate_frames = true;
+            else background_filename = option;
+        }
+        if (options.threaded_pipeline && options.deduplicate_frames)
+        {
+            cout << "--dedup is not supported with --pipeline" << endl;
+            return -1;
+        }
+        return MyHeadlessApplication(argv[2], background_filename, options);
+    }
+
+    // Perspective transformation microbenchmark:  draughts-game-analysis --benchmark-warp [<image>]
+    if ((argc >= 2) && (string(argv[1]) == "--benchmark-warp"))
+    {
+        string image_filename = (argc >= 3) ? argv[2] : "Media/DraughtsGame1Move0.JPG";
+        return BenchmarkPerspectiveTransformation(image_filename, 1000);
+    }
+
+    // Difference/threshold parity check and microbenchmark:  draughts-game-analysis --benchmark-difference [<image> [<empty board image>]]
+    if ((argc >= 2) && (string(argv[1]) == "--benchmark-difference"))
+    {
+        string image_filename = (argc >= 3) ? argv[2] : "Media/DraughtsGame1Move0.JPG";
+        string background_filename = (argc >= 4) ? argv[3] : "Media/DraughtsGame1EmptyBoard.JPG";
+        return BenchmarkDifferenceThreshold(image_filename, background_filename, 1000);
+    }
+
+    // Check that steady-state frames do not allocate (other than inside OpenCV):  draughts-game-analysis --check-allocations [<empty board image>]
+    // (only in builds which define CHECK_FRAME_ALLOCATIONS)
+    if ((argc >= 2) && (string(argv[1]) == "--check-allocations"))
+    {
+        string background_filename = (argc >= 3) ? argv[2] : "Media/DraughtsGame1EmptyBoard.JPG";
+        return CheckFrameAllocations(background_filename);
+    }
+
+    // Pixel classification against labelled images:  draughts-game-analysis --evaluate-pixels [<image> <ground truth image> ...]
+    if ((argc >= 2) && (string(argv[1]) == "--evaluate-pixels"))
+    {
+        vector<string> image_filenames, ground_truth_filenames;
+        for (int argument = 2; argument + 1 < argc; argument += 2)
+        {
+            image_filenames.push_back(argv[argument]);
+            ground_truth_filenames.push_back(argv[argument + 1]);
+        }
+        if (image_filenames.empty())
+        {
+            image_filenames.push_back("Media/DraughtsGame1Move0.JPG");
+            ground_truth_filenames.push_back("Media/DraughtsGame1Move0GroundTruth.png");
+        }
+        return EvaluatePixelClassification(image_filenames, ground_truth_filenames);
+    }
+
+    // Parameter sweep over the static images:  draughts-game-analysis --sweep [--difference <values>] [--occupancy <values>]
+    //     [--circularity <values>] [--hue-bins <values>] [--probability <values>] [--persistence <values>] [--video <video>]
+    //     [<empty board image>]   (where <values> are comma separated)
+    // The probability values are the part1 background thresholds, which are swept separately over part1's labelled image.
+    // The persistence values are the number of the last 10 frames in which part3 must see a square change, which are swept
+    // separately over the video (Media/DraughtsGame1.avi by default).
+    if ((argc >= 2) && (string(argv[1]) == "--sweep"))
+    {
+        string background_filename = "Media/DraughtsGame1EmptyBoard.JPG";
+        vector<double> difference_thresholds = { 20, 25, 30, 35, 40 };
+        vector<double> occupancy_thresholds = { 0.15, 0.2, 0.25, 0.3, 0.35 };
+        vector<double> king_circularity_thresholds = { 0.75, 0.8, 0.85 };
+        vector<double> hue_bins = { 20, 25, 30 };
+        vector<double> probability_thresholds = { 95, 111, 127, 143, 159 };
+        vector<double> change_persistence_frames = { 3, 4, 5, 6, 7 };
+        string video_filename = "Media/DraughtsGame1.avi";
+        for (int argument = 2; argument < argc; argument++)
+        {
+            string option(argv[argument]);
+            if ((option == "--difference") && (argument + 1 < argc))
+                difference_thresholds = ParseValues(argv[++argument]);
+            else if ((option == "--occupancy") && (argument + 1 < argc))
+                occupancy_thresholds = ParseValues(argv[++argument]);
+            else if ((option == "--circularity") && (argument + 1 < argc))
+                king_circularity_thresholds = ParseValues(argv[++argument]);
+            else if ((option == "--hue-bins") && (argument + 1 < argc))
+                hue_bins = ParseValues(argv[++argument]);
+            else if ((option == "--probability") && (argument + 1 < argc))
+                probability_thresholds = ParseValues(argv[++argument]);
+            else if ((option == "--persistence") && (argument + 1 < argc))
+                change_persistence_frames = ParseValues(argv[++argument]);
+            else if ((option == "--video") && (argument + 1 < argc))
+                video_filename = argv[++argument];
+            else background_filename = option;
+        }
+        return SweepStillImageParameters(background_filename, difference_thresholds, occupancy_thresholds, king_circularity_thresholds, hue_bins, probability_thresholds,
+            video_filename, change_persistence_frames);
+    }
+
     MyApplication();
 
     // Wait for any keystroke in the window